@@ -0,0 +1,88 @@
+#ifndef SRC_CAMERA_CAMERABACKEND_H
+#define SRC_CAMERA_CAMERABACKEND_H
+
+#include <gphoto2/gphoto2-camera.h>
+
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+
+// Names of the configs read and written by CameraWrapper
+static const string CONFIG_SERIAL_NUMBER = "serialnumber";
+static const string CONFIG_EXPOSURE_TIME = "500d";
+
+/**
+ * Low level camera operations used by CameraWrapper.
+ * Every method returns a libgphoto2 result code (GP_OK on success).
+ * Implementations do not need to be thread safe: CameraWorker makes all the
+ * calls from its own thread, except for onRemoteTrigger().
+ */
+class CameraBackend
+{
+public:
+    virtual ~CameraBackend() {}
+
+    /**
+     * Opens the connection with the camera.
+     */
+    virtual int init() = 0;
+
+    /**
+     * Closes the connection with the camera. Does nothing if not initialized.
+     */
+    virtual void exit() = 0;
+
+    /**
+     * Takes a picture using the exposure time set on the camera.
+     * @param path Path of the captured file on the camera
+     */
+    virtual int capture(CameraFilePath& path) = 0;
+
+    /**
+     * Downloads a file from the camera.
+     * @param path Path of the file on the camera
+     * @param fd Descriptor of the file where the data will be written. It is
+     * always closed by the call, as libgphoto2 does with the descriptors of
+     * its CameraFiles
+     */
+    virtual int getFile(const CameraFilePath& path, int fd) = 0;
+
+    /**
+     * Reads the size of a file on the camera, in bytes.
+     */
+    virtual int getFileSize(const CameraFilePath& path, size_t& size) = 0;
+
+    /**
+     * Waits for an event from the camera.
+     * @param timeout Timeout in milliseconds
+     * @param type Type of the received event
+     * @param file Path of the new file, if type is GP_EVENT_FILE_ADDED
+     */
+    virtual int waitForEvent(int timeout, CameraEventType& type,
+                             CameraFilePath& file) = 0;
+
+    /**
+     * Reads the value of a text, menu or radio config.
+     */
+    virtual int getConfigValue(const string& config_name, string& value) = 0;
+
+    /**
+     * Writes the value of a text, menu or radio config.
+     */
+    virtual int setConfigValue(const string& config_name,
+                               const string& value) = 0;
+
+    virtual int listConfigChoices(const string& config_name,
+                                  vector<string>& choices) = 0;
+
+    /**
+     * Called every time the IR remote trigger is fired, possibly while another
+     * operation (eg: a download) is in progress.
+     * Real cameras see the trigger directly, so the default does nothing.
+     */
+    virtual void onRemoteTrigger() {}
+};
+
+#endif /* SRC_CAMERA_CAMERABACKEND_H */
@@ -0,0 +1,149 @@
+#include "CameraWorker.h"
+
+using std::lock_guard;
+using std::unique_lock;
+
+CameraWorker::CameraWorker(CameraBackend* backend) : backend(backend)
+{
+    thread_worker =
+        unique_ptr<thread>(new thread(&CameraWorker::run, this));
+}
+
+CameraWorker::~CameraWorker()
+{
+    {
+        lock_guard<mutex> l(mtx_queue);
+        stopped = true;
+    }
+    cv_queue.notify_all();
+    thread_worker->join();
+
+    backend->exit();
+}
+
+future<void> CameraWorker::setBackend(CameraBackend* new_backend)
+{
+    return submit<void>(REQUEST_CONTROL, [this, new_backend](CameraBackend& b) {
+        b.exit();
+
+        lock_guard<mutex> l(mtx_backend);
+        backend = unique_ptr<CameraBackend>(new_backend);
+    });
+}
+
+future<int> CameraWorker::init()
+{
+    return submit<int>(REQUEST_CONTROL,
+                       [](CameraBackend& b) { return b.init(); });
+}
+
+future<void> CameraWorker::exit()
+{
+    return submit<void>(REQUEST_CONTROL, [](CameraBackend& b) { b.exit(); });
+}
+
+future<CameraResult<CameraFilePath>> CameraWorker::capture()
+{
+    return submit<CameraResult<CameraFilePath>>(
+        REQUEST_CONTROL, [](CameraBackend& b) {
+            CameraResult<CameraFilePath> r;
+            r.code = b.capture(r.value);
+            return r;
+        });
+}
+
+future<int> CameraWorker::getFile(const CameraFilePath& path, int fd)
+{
+    return submit<int>(REQUEST_TRANSFER, [path, fd](CameraBackend& b) {
+        return b.getFile(path, fd);
+    });
+}
+
+future<CameraResult<size_t>> CameraWorker::getFileSize(
+    const CameraFilePath& path)
+{
+    return submit<CameraResult<size_t>>(
+        REQUEST_CONTROL, [path](CameraBackend& b) {
+            CameraResult<size_t> r;
+            r.code = b.getFileSize(path, r.value);
+            return r;
+        });
+}
+
+future<CameraResult<CameraEvent>> CameraWorker::waitForEvent(int timeout)
+{
+    return submit<CameraResult<CameraEvent>>(
+        REQUEST_CONTROL, [timeout](CameraBackend& b) {
+            CameraResult<CameraEvent> r;
+            r.code = b.waitForEvent(timeout, r.value.type, r.value.file);
+            return r;
+        });
+}
+
+future<CameraResult<string>> CameraWorker::getConfigValue(
+    const string& config_name)
+{
+    return submit<CameraResult<string>>(
+        REQUEST_CONTROL, [config_name](CameraBackend& b) {
+            CameraResult<string> r;
+            r.code = b.getConfigValue(config_name, r.value);
+            return r;
+        });
+}
+
+future<int> CameraWorker::setConfigValue(const string& config_name,
+                                         const string& value)
+{
+    return submit<int>(REQUEST_CONTROL, [config_name, value](CameraBackend& b) {
+        return b.setConfigValue(config_name, value);
+    });
+}
+
+future<CameraResult<vector<string>>> CameraWorker::listConfigChoices(
+    const string& config_name)
+{
+    return submit<CameraResult<vector<string>>>(
+        REQUEST_CONTROL, [config_name](CameraBackend& b) {
+            CameraResult<vector<string>> r;
+            r.code = b.listConfigChoices(config_name, r.value);
+            return r;
+        });
+}
+
+void CameraWorker::onRemoteTrigger()
+{
+    lock_guard<mutex> l(mtx_backend);
+    backend->onRemoteTrigger();
+}
+
+bool CameraWorker::takeRequest(Request& req)
+{
+    unique_lock<mutex> l(mtx_queue);
+    while (true)
+    {
+        for (int c = 0; c < REQUEST_NUM_CLASSES; c++)
+        {
+            if (!queues[c].empty())
+            {
+                req = std::move(queues[c].front());
+                queues[c].pop_front();
+                return true;
+            }
+        }
+        // Serve every pending request before stopping
+        if (stopped)
+        {
+            return false;
+        }
+        cv_queue.wait(l);
+    }
+}
+
+void CameraWorker::run()
+{
+    Request req;
+    while (takeRequest(req))
+    {
+        req(*backend);
+    }
+}
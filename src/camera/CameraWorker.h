@@ -0,0 +1,129 @@
+#ifndef SRC_CAMERA_CAMERAWORKER_H
+#define SRC_CAMERA_CAMERAWORKER_H
+
+#include <gphoto2/gphoto2-camera.h>
+#include <gphoto2/gphoto2-result.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CameraBackend.h"
+
+using std::condition_variable;
+using std::deque;
+using std::function;
+using std::future;
+using std::mutex;
+using std::packaged_task;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+/**
+ * libgphoto2 result code, plus the value returned by the operation.
+ */
+template <typename T>
+struct CameraResult
+{
+    int code = GP_OK;
+    T value{};
+};
+
+struct CameraEvent
+{
+    CameraEventType type = GP_EVENT_UNKNOWN;
+    CameraFilePath file{};
+};
+
+/**
+ * Owns the camera backend and executes every operation on it from a single
+ * thread, so that libgphoto2 is never used concurrently.
+ * Requests are queued and return a future with their result.
+ * Control requests (captures, events, configs) are served before the queued
+ * file transfers, so a long download never delays the next exposure.
+ */
+class CameraWorker
+{
+public:
+    /**
+     * @param backend Initial backend. The worker takes ownership of it.
+     */
+    CameraWorker(CameraBackend* backend);
+    ~CameraWorker();
+
+    /**
+     * Closes the current backend and replaces it.
+     * @param backend The new backend. The worker takes ownership of it.
+     */
+    future<void> setBackend(CameraBackend* backend);
+
+    future<int> init();
+    future<void> exit();
+
+    future<CameraResult<CameraFilePath>> capture();
+    future<int> getFile(const CameraFilePath& path, int fd);
+    future<CameraResult<size_t>> getFileSize(const CameraFilePath& path);
+    future<CameraResult<CameraEvent>> waitForEvent(int timeout);
+
+    future<CameraResult<string>> getConfigValue(const string& config_name);
+    future<int> setConfigValue(const string& config_name, const string& value);
+    future<CameraResult<vector<string>>> listConfigChoices(
+        const string& config_name);
+
+    /**
+     * Notifies the backend of an IR trigger directly from the calling thread,
+     * without waiting for the queued requests.
+     */
+    void onRemoteTrigger();
+
+private:
+    enum RequestClass
+    {
+        REQUEST_CONTROL = 0,
+        REQUEST_TRANSFER,
+        REQUEST_NUM_CLASSES
+    };
+
+    typedef function<void(CameraBackend&)> Request;
+
+    template <typename R>
+    future<R> submit(RequestClass cls, function<R(CameraBackend&)> fn)
+    {
+        // std::function must be copyable: share the task
+        auto task = std::make_shared<packaged_task<R(CameraBackend&)>>(fn);
+        future<R> f = task->get_future();
+
+        {
+            std::lock_guard<mutex> l(mtx_queue);
+            queues[cls].push_back([task](CameraBackend& b) { (*task)(b); });
+        }
+        cv_queue.notify_one();
+        return f;
+    }
+
+    void run();
+
+    bool takeRequest(Request& req);
+
+    // Only replaced on the worker thread, while holding mtx_backend
+    unique_ptr<CameraBackend> backend;
+    mutex mtx_backend;
+
+    mutex mtx_queue;
+    condition_variable cv_queue;
+    deque<Request> queues[REQUEST_NUM_CLASSES];
+    bool stopped = false;
+
+    unique_ptr<thread> thread_worker;
+};
+
+#endif /* SRC_CAMERA_CAMERAWORKER_H */
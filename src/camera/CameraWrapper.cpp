@@ -7,74 +7,201 @@
 #include <gphoto2/gphoto2.h>
 #include <cmath>
 
+#include "GPhoto2Backend.h"
+
+#include <unistd.h>
+
 #include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <cstdio>
 #include <cstring>
+#include <ctime>
 #include <thread>
 
 #include "logger.h"
 #include "utils/RemoteTrigger.h"
+#include "utils/TimingStats.h"
 
 using namespace std::this_thread;
 
+using std::lock_guard;
 using std::max;
 using std::min;
 using std::chrono::duration_cast;
+using std::chrono::microseconds;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::chrono::system_clock;
 
 typedef system_clock Clock;
 
-CameraWrapper::CameraWrapper() : context(gp_context_new()) {}
+CameraWrapper::CameraWrapper() : worker(new GPhoto2Backend()) {}
 
 CameraWrapper::~CameraWrapper() { freeCamera(); }
 
+void CameraWrapper::setBackend(CameraBackend* new_backend)
+{
+    disconnect();
+    worker.setBackend(new_backend).wait();
+}
+
 void CameraWrapper::freeCamera()
 {
-    if (camera != nullptr)
-    {
-        gp_camera_exit(camera, context);
-        gp_camera_free(camera);
-        camera = nullptr;
-    }
+    worker.exit().wait();
+    config_cache.invalidateAll();
 }
 
 bool CameraWrapper::connect()
 {
-    if (!connected)
-    {
-        int result = gp_camera_new(&camera);
+    // The connection lock is only taken between attempts, so that
+    // isResponsive() and disconnect() are not blocked while retrying
+    lock_guard<mutex> lc(mtx_connect);
 
-        if (result != GP_OK)
+    milliseconds timeout;
+    {
+        lock_guard<mutex> l(mtx_connection);
+        if (connected)
         {
-            Log.e("Error instantiating camera: %d", result);
-            return false;
+            return true;
         }
+        connect_cancelled = false;
+        timeout           = ready_timeout;
+    }
 
-        result = gp_camera_init(camera, context);
+    auto start    = steady_clock::now();
+    auto deadline = start + timeout;
 
-        if (result == GP_OK)
-        {
-            serial = getSerialNumber();
+    // The camera may still be busy after a disconnection
+    int result = initCamera();
+    while (result != GP_OK && !connect_cancelled &&
+           steady_clock::now() + CONNECT_RETRY_INTERVAL < deadline)
+    {
+        sleep_for(CONNECT_RETRY_INTERVAL);
+        result = initCamera();
+    }
+    if (result != GP_OK)
+    {
+        Log.e("Error initiating camera: %d", result);
+
+        // Be more patient on the next attempt
+        lock_guard<mutex> l(mtx_connection);
+        ready_timeout = READY_TIMEOUT_MAX;
+        return false;
+    }
 
-            // Sleep for 2 seconds to avoid errors if capturing too early
-            std::this_thread::sleep_for(seconds(2));
+    config_cache.invalidateAll();
 
-            Log.i("Connected to camera: %s", serial.c_str());
-            connected = true;
-            return true;
+    bool ready = waitUntilReady(deadline);
+
+    lock_guard<mutex> l(mtx_connection);
+    if (!ready || connect_cancelled)
+    {
+        if (!ready)
+        {
+            Log.e("Camera not ready after %d ms", (int)timeout.count());
+            ready_timeout = READY_TIMEOUT_MAX;
         }
-        Log.e("Error initiating camera: %d", result);
-        gp_camera_free(camera);
+        freeCamera();
         return false;
     }
+    serial = getSerialNumber();
+
+    auto latency = duration_cast<milliseconds>(steady_clock::now() - start);
+    Timings.record(TIMING_CONNECT, latency);
+    ready_timeout = connectTimeout();
+
+    Log.i("Connected to camera: %s (%d ms)", serial.c_str(),
+          (int)latency.count());
+    connected = true;
     return true;
 }
 
+int CameraWrapper::initCamera()
+{
+    lock_guard<mutex> l(mtx_connection);
+    if (connect_cancelled)
+    {
+        return GP_ERROR_CANCEL;
+    }
+    return worker.init().get();
+}
+
+milliseconds CameraWrapper::connectTimeout()
+{
+    // A few fast connects must not leave too little time to the next, slower
+    // one: be patient until enough connects were measured
+    const Histogram& h = Timings.get(TIMING_CONNECT);
+    if (h.count() < CONNECT_SAMPLES_MIN)
+    {
+        return READY_TIMEOUT_MAX;
+    }
+
+    // Leave a margin for slower connections
+    milliseconds p99 = duration_cast<milliseconds>(
+        std::chrono::microseconds(h.percentile(99)));
+    return min(max(p99 * 3, READY_TIMEOUT_MIN), READY_TIMEOUT_MAX);
+}
+
+bool CameraWrapper::waitUntilReady(steady_clock::time_point deadline)
+{
+    int poll_ms = (int)READY_POLL_INTERVAL.count();
+
+    while (!connect_cancelled && steady_clock::now() < deadline)
+    {
+        // Events are reported after connecting: drain them until idle
+        auto event = worker.waitForEvent(poll_ms).get();
+        if (event.code != GP_OK)
+        {
+            sleep_for(READY_POLL_INTERVAL);
+            continue;
+        }
+        onEvent(event.value);
+        if (event.value.type != GP_EVENT_TIMEOUT)
+        {
+            continue;
+        }
+
+        auto r = worker.getConfigValue(CONFIG_SERIAL_NUMBER).get();
+        if (r.code == GP_OK && r.value != "")
+        {
+            // The serial number never changes while connected
+            config_cache.putValue(CONFIG_SERIAL_NUMBER, r.value, true);
+            return true;
+        }
+        sleep_for(READY_POLL_INTERVAL);
+    }
+    return false;
+}
+
+void CameraWrapper::onEvent(const CameraEvent& event)
+{
+    if (event.type == GP_EVENT_UNKNOWN)
+    {
+        // Config changes on the camera are reported as unknown events
+        config_cache.invalidateValues();
+    }
+}
+
+void CameraWrapper::pollEvents()
+{
+    for (unsigned int i = 0; i < MAX_PENDING_EVENTS; i++)
+    {
+        auto event = worker.waitForEvent(0).get();
+        if (event.code != GP_OK || event.value.type == GP_EVENT_TIMEOUT)
+        {
+            return;
+        }
+        onEvent(event.value);
+    }
+}
+
 void CameraWrapper::disconnect()
 {
+    lock_guard<mutex> l(mtx_connection);
+    // Also stops a connect() in progress
+    connect_cancelled = true;
     if (connected)
     {
         freeCamera();
@@ -86,32 +213,24 @@ bool CameraWrapper::isConnected() { return connected; }
 
 bool CameraWrapper::isResponsive()
 {
-    return connected && camera != nullptr && getSerialNumber() == serial;
+    string expected;
+    {
+        lock_guard<mutex> l(mtx_connection);
+        expected = serial;
+    }
+    // Always ask the camera: this is a connection check
+    return connected && readConfigValue(CONFIG_SERIAL_NUMBER) == expected;
 }
 
 bool CameraWrapper::capture(int exposure_time, string download_folder)
 {
     CameraFilePath p{};
 
-    if (getCurrentExposureTime() == 0)  // If BULB use remote trigger
+    if (!capture(exposure_time, p))
     {
-        if (!remoteCapture(exposure_time, p))
-        {
-            Log.e("Sequencer capture failed.");
-            return false;
-        }
-    }
-    else
-    {
-        if (!wiredCapture(p))
-        {
-            Log.e("Sequencer capture failed.");
-            return false;
-        }
+        return false;
     }
 
-    Log.d("Captured exposure");
-
     if (download_folder.compare("") != 0)
     {
         auto download_start = Clock::now();
@@ -134,6 +253,29 @@ bool CameraWrapper::capture(int exposure_time, string download_folder)
     return true;
 }
 
+bool CameraWrapper::capture(int exposure_time, CameraFilePath& path)
+{
+    if (getCurrentExposureTime() == 0)  // If BULB use remote trigger
+    {
+        if (!remoteCapture(exposure_time, path))
+        {
+            Log.e("Sequencer capture failed.");
+            return false;
+        }
+    }
+    else
+    {
+        if (!wiredCapture(path))
+        {
+            Log.e("Sequencer capture failed.");
+            return false;
+        }
+    }
+
+    Log.d("Captured exposure");
+    return true;
+}
+
 bool CameraWrapper::remoteCapture(int exposure_time, CameraFilePath& path)
 {
     int curr_exp = getCurrentExposureTime();
@@ -143,37 +285,110 @@ bool CameraWrapper::remoteCapture(int exposure_time, CameraFilePath& path)
         return false;
     }
 
-    Log.i("Trigger 1");
+    Log.i("Remote capture: %d ms", exposure_time);
 
-    const milliseconds checkpoint_interval(30000);
+    ExposureTiming timing;
+    timing.requested = milliseconds(exposure_time);
+    TriggerReport reports[2];
+    bool fired = false;
 
-    trigger();
+    // The exposure length only depends on the timing of the realtime thread:
+    // everything else is done here
+    auto end_estimate = steady_clock::now() + getTriggerLatency() +
+                        milliseconds(exposure_time);
+    auto done = trigger_thread.post([&]() {
+        triggerExposure(timing, reports);
+        fired = true;
+    });
 
-    auto now          = Clock::now();
-    auto end_exposure = now + milliseconds(exposure_time);
-    do
+    while (done.wait_for(BULB_PROGRESS_INTERVAL) != std::future_status::ready)
     {
-        now            = Clock::now();
-        auto remaining = duration_cast<milliseconds>(end_exposure - now);
+        auto remaining =
+            duration_cast<milliseconds>(end_estimate - steady_clock::now());
         Log.i("Remote capture: %d ms left", (int)remaining.count());
+    }
+    if (!fired)
+    {
+        Log.e("Remote capture: trigger thread stopped.");
+        return false;
+    }
+    onExposure(timing, reports);
 
-        if (remaining < checkpoint_interval)
-        {
-            sleep_until(end_exposure);
-        }
-        else
-        {
-            sleep_for(checkpoint_interval);
-        }
-    } while (now < end_exposure);
+    return waitForCapture(path);
+}
+
+void CameraWrapper::triggerExposure(ExposureTiming& timing,
+                                    TriggerReport reports[2])
+{
+    timing.open = fireTrigger(steady_clock::now() + getTriggerLatency(),
+                              reports[0]);
+    timing.open_wall =
+        system_clock::now() - (steady_clock::now() - timing.open);
 
-    trigger();
-    Log.i("Trigger 2");
+    // Both triggers have the same latency: start closing early so that the
+    // camera receives the second one at the end of the exposure
+    auto end_exposure = timing.open + timing.requested;
+    sleep_until(end_exposure - getTriggerLatency() - BULB_WAKE_MARGIN);
 
-    // Wait a bit before checking for capture completed
-    //sleep_for(milliseconds(250));
+    timing.close = fireTrigger(end_exposure, reports[1]);
+}
 
-    return waitForCapture(path);
+steady_clock::time_point CameraWrapper::fireTrigger(
+    steady_clock::time_point at, TriggerReport& report)
+{
+    auto trigger_start = at - getTriggerLatency();
+    auto received      = triggerAt(at, report.playback);
+    report.latency     = steady_clock::now() - trigger_start;
+    return received;
+}
+
+void CameraWrapper::onExposure(const ExposureTiming& timing,
+                               const TriggerReport reports[2])
+{
+    for (int i = 0; i < 2; i++)
+    {
+        reportTrigger(reports[i].playback);
+        Timings.record(TIMING_TRIGGER_LATENCY, reports[i].latency);
+
+        // The IR trigger does not go through USB: don't wait for other
+        // operations
+        worker.onRemoteTrigger();
+    }
+
+    auto error = timing.close - (timing.open + timing.requested);
+    Timings.record(TIMING_EXPOSURE_ERROR, error.count() > 0 ? error : -error);
+
+    logExposure(timing);
+
+    lock_guard<mutex> l(mtx_exposures);
+    if (exposures.size() >= EXPOSURE_HISTORY_SIZE)
+    {
+        exposures.pop_front();
+    }
+    exposures.push_back(timing);
+}
+
+void CameraWrapper::logExposure(const ExposureTiming& timing)
+{
+    auto open_us = duration_cast<microseconds>(
+        timing.open_wall.time_since_epoch());
+    time_t open_s = (time_t)(open_us.count() / 1000000);
+    struct tm open_tm;
+    localtime_r(&open_s, &open_tm);
+
+    char open_str[16];
+    strftime(open_str, sizeof(open_str), "%H:%M:%S", &open_tm);
+
+    auto length = duration_cast<microseconds>(timing.close - timing.open);
+    Log.i("Exposure: open %s.%06d, close +%.3f ms (requested: %d ms)",
+          open_str, (int)(open_us.count() % 1000000), length.count() / 1000.0,
+          (int)timing.requested.count());
+}
+
+vector<ExposureTiming> CameraWrapper::getExposures()
+{
+    lock_guard<mutex> l(mtx_exposures);
+    return vector<ExposureTiming>(exposures.begin(), exposures.end());
 }
 
 bool CameraWrapper::wiredCapture()
@@ -184,8 +399,13 @@ bool CameraWrapper::wiredCapture()
 
 bool CameraWrapper::wiredCapture(CameraFilePath& path)
 {
-    int result = gp_camera_capture(camera, GP_CAPTURE_IMAGE, &path, context);
+    auto capture_start = steady_clock::now();
+    auto r             = worker.capture().get();
+    // Includes the exposure: not comparable with the BULB capture wait
+    Timings.record(TIMING_WIRED_CAPTURE, steady_clock::now() - capture_start);
 
+    int result = r.code;
+    path       = r.value;
     if (result == GP_OK)
     {
         Log.d("Captured to: %s/%s", path.folder, path.name);
@@ -202,154 +422,109 @@ bool CameraWrapper::wiredCapture(CameraFilePath& path)
 
 bool CameraWrapper::downloadFile(CameraFilePath path, string dest_file_path)
 {
-    CameraFile* file;
-    int result, fd;
-    bool success = false, gp_file_created = false;
+    auto download_start = steady_clock::now();
     Log.d("Download file: %s, fld: %s", path.name, path.folder);
 
     Log.d("Download dest: %s", dest_file_path.c_str());
-    FILE* f = fopen(dest_file_path.c_str(), "w");
-
-    if (f == NULL)
-    {
-        Log.e("Error opening file (%s): %s", dest_file_path.c_str(),
-              std::strerror(errno));
-        goto out;
-    }
 
-    fd = fileno(f);
+    // Preallocate the file if the camera knows its size
+    auto size = worker.getFileSize(path).get();
 
-    if (fd < 0)
+    StorageFile file;
+    if (!storage.open(dest_file_path, size.code == GP_OK ? size.value : 0,
+                      file))
     {
-        Log.e("Error getting file descriptor (%s): %d", dest_file_path.c_str(),
-              fd);
-        goto out;
+        return false;
     }
 
-    result = gp_file_new_from_fd(&file, fd);
-    if (result != GP_OK)
-    {
-        Log.e("Error creating CameraFile (%s): %d", dest_file_path.c_str(),
-              result);
-        goto out;
-    }
-    else
+    // The backend closes the descriptor it is given, while the storage still
+    // needs its own to finish the file
+    int fd = dup(file.fd);
+    if (fd < 0)
     {
-        gp_file_created = true;
+        Log.e("Error duplicating file descriptor: %s", std::strerror(errno));
+        storage.discard(file);
+        return false;
     }
 
-    result = gp_camera_file_get(camera, path.folder, path.name,
-                                GP_FILE_TYPE_RAW, file, context);
+    int result = worker.getFile(path, fd).get();
     if (result != GP_OK)
     {
         Log.e("Error getting file from camera (%s): %d", dest_file_path.c_str(),
               result);
-        goto out;
-    }
-    success = true;
-out:
-    if (f != NULL)
-    {
-        fclose(f);
+        storage.discard(file);
+        return false;
     }
-    if (gp_file_created)
+
+    auto commit_start = steady_clock::now();
+    if (!storage.commit(file))
     {
-        gp_file_free(file);
+        return false;
     }
-    return success;
+
+    auto now = steady_clock::now();
+    Timings.record(TIMING_DISK_WRITE, now - commit_start);
+    Timings.record(TIMING_DOWNLOAD, now - download_start);
+    return true;
 }
 
 string CameraWrapper::getSerialNumber()
 {
-    return getTextConfigValue(CONFIG_SERIAL_NUMBER);
+    string value;
+    if (config_cache.getValue(CONFIG_SERIAL_NUMBER, value))
+    {
+        return value;
+    }
+
+    value = readConfigValue(CONFIG_SERIAL_NUMBER);
+    if (value != "")
+    {
+        // The serial number never changes while connected
+        config_cache.putValue(CONFIG_SERIAL_NUMBER, value, true);
+    }
+    return value;
 }
 
 string CameraWrapper::getTextConfigValue(string config_name)
 {
-    string value_str = "";
-    CameraWidget* widget;
-
-    int result = gp_camera_get_single_config(camera, config_name.c_str(),
-                                             &widget, context);
-    if (result != GP_OK)
+    string value;
+    if (config_cache.getValue(config_name, value))
     {
-        Log.e("Couldn't get single config (%s): %d", config_name.c_str(),
-              result);
-        return value_str;
+        return value;
     }
 
-    const char* value;
-    result = gp_widget_get_value(widget, &value);
-
-    if (result != GP_OK)
+    value = readConfigValue(config_name);
+    if (value != "")
     {
-        Log.e("Couldn't get widget value (%s): %d", config_name.c_str(),
-              result);
-        goto out;
+        config_cache.putValue(config_name, value);
     }
-    value_str = string(value);
+    return value;
+}
 
-out:
-    gp_widget_free(widget);
-    return value_str;
+string CameraWrapper::readConfigValue(string config_name)
+{
+    auto r = worker.getConfigValue(config_name).get();
+    if (r.code != GP_OK)
+    {
+        Log.e("Couldn't get config (%s): %d", config_name.c_str(), r.code);
+        return "";
+    }
+    return r.value;
 }
 
 bool CameraWrapper::setConfigValue(string config_name, string value)
 {
-    bool success = false;
+    int result = worker.setConfigValue(config_name, value).get();
+    // Let the next read get the value actually set on the camera
+    config_cache.invalidate(config_name);
 
-    CameraWidget* widget;
-    int result = gp_camera_get_single_config(camera, config_name.c_str(),
-                                             &widget, context);
     if (result != GP_OK)
     {
-        Log.e("Couldn't get single config (%s): %d", config_name.c_str(),
+        Log.e("Couldn't set config on camera (%s): %d", config_name.c_str(),
               result);
-        return success;
-    }
-    CameraWidgetType type;
-    result = gp_widget_get_type(widget, &type);
-    if (result != GP_OK)
-    {
-        Log.e("Couldn't get config type (%s): %d", config_name.c_str(), result);
-        goto out;
-    }
-
-    switch (type)
-    {
-        case GP_WIDGET_MENU:
-        case GP_WIDGET_RADIO:
-        case GP_WIDGET_TEXT:
-        {
-            result = gp_widget_set_value(widget, value.c_str());
-            if (result != GP_OK)
-            {
-                Log.e("Couldn't set config value (%s): %d", config_name.c_str(),
-                      result);
-                goto out;
-            }
-            // Finally set the config on the camera
-            result = gp_camera_set_single_config(camera, config_name.c_str(),
-                                                 widget, context);
-            if (result != GP_OK)
-            {
-                Log.e("Couldn't set config on camera (%s): %d",
-                      config_name.c_str(), result);
-                goto out;
-            }
-            success = true;
-            goto out;
-            break;
-        }
-
-        default:
-            Log.e("Bad widget type (%s): %d", config_name.c_str(), type);
-            goto out;
+        return false;
     }
-
-out:
-    gp_widget_free(widget);
-    return success;
+    return true;
 }
 
 int CameraWrapper::getCurrentExposureTime()
@@ -376,35 +551,22 @@ bool CameraWrapper::setExposureTime(int index)
 vector<string> CameraWrapper::listConfigChoices(string config_name)
 {
     vector<string> choices;
-    CameraWidget* widget;
-    int result = gp_camera_get_single_config(camera, config_name.c_str(),
-                                             &widget, context);
-    int n;
-
-    if (result != GP_OK)
+    if (config_cache.getChoices(config_name, choices))
     {
-        Log.e("Couldn't get single config (%s): %d", config_name.c_str(),
-              result);
         return choices;
     }
 
-    n = gp_widget_count_choices(widget);
+    auto r = worker.listConfigChoices(config_name).get();
 
-    const char* ch;
-    for (int i = 0; i < n; i++)
+    if (r.code != GP_OK)
     {
-        int result = gp_widget_get_choice(widget, i, &ch);
-        if (result != GP_OK)
-        {
-            Log.e("Couldn't get choice (%s): %d", config_name.c_str(), result);
-            goto out;
-        }
-        choices.push_back(string(ch));
+        Log.e("Couldn't list config choices (%s): %d", config_name.c_str(),
+              r.code);
+        choices.clear();
+        return choices;
     }
-
-out:
-    gp_widget_free(widget);
-    return choices;
+    config_cache.putChoices(config_name, r.value);
+    return r.value;
 }
 
 vector<int> CameraWrapper::listAvailableExposureTimes()
@@ -430,21 +592,24 @@ bool CameraWrapper::waitForCapture(CameraFilePath& file, int timeout)
 {
     const milliseconds min_wait_time(1000);
     CameraEventType type;
-    void* data;
+    CameraFilePath event_file{};
 
-    auto c_start = Clock::now();
+    auto c_start = steady_clock::now();
 
     do
     {
         auto start = std::chrono::system_clock::now();
-        int res =
-            gp_camera_wait_for_event(camera, timeout, &type, &data, context);
+        auto r     = worker.waitForEvent(timeout).get();
+        int res    = r.code;
+        type       = r.value.type;
+        event_file = r.value.file;
 
         if (res != GP_OK)
         {
             Log.e("Couldn't wait for event");
             return false;
         }
+        onEvent(r.value);
         auto end = std::chrono::system_clock::now();
 
         auto duration = duration_cast<milliseconds>(end - start);
@@ -452,15 +617,21 @@ bool CameraWrapper::waitForCapture(CameraFilePath& file, int timeout)
         timeout -= dur;
     } while (type != GP_EVENT_FILE_ADDED);
 
-    auto c_end    = Clock::now();
+    auto c_end    = steady_clock::now();
     auto duration = duration_cast<milliseconds>(c_end - c_start);
+    Timings.record(TIMING_CAPTURE_WAIT, c_end - c_start);
     int dur       = (int)duration.count();
 
-    if (duration < min_wait_time)
+    // The events following the file (eg: capture complete) are read during
+    // the wait below
+    pollEvents();
+
+    auto waited = duration_cast<milliseconds>(steady_clock::now() - c_start);
+    if (waited < min_wait_time)
     {
         Log.w("Additional wait of %d ms",
-              (int)milliseconds(min_wait_time - duration).count());
-        sleep_for(min_wait_time - duration);
+              (int)milliseconds(min_wait_time - waited).count());
+        sleep_for(min_wait_time - waited);
     }
 
     switch (type)
@@ -473,7 +644,7 @@ bool CameraWrapper::waitForCapture(CameraFilePath& file, int timeout)
             break;
         case GP_EVENT_FILE_ADDED:
             Log.i("GP_EVENT_FILE_ADDED T:%d ms", dur);
-            file = *((CameraFilePath*)data);
+            file = event_file;
             return true;
         case GP_EVENT_FOLDER_ADDED:
             Log.i("GP_EVENT_FOLDER_ADDED T:%d ms", dur);
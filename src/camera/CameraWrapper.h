@@ -8,16 +8,68 @@
 
 #include <gphoto2/gphoto2.h>
 #include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
+#include "CameraBackend.h"
+#include "CameraWorker.h"
+#include "CaptureStorage.h"
+#include "ConfigCache.h"
+#include "utils/RealtimeThread.h"
+#include "utils/WaveformPlayer.h"
+
+using std::atomic_bool;
+using std::deque;
+using std::mutex;
 using std::string;
+using std::unique_ptr;
 using std::vector;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
 
 static const string NOT_A_GOOD_SERIAL = "NOT_A_GOOD_SERIAL";
 
-static const string CONFIG_SERIAL_NUMBER = "serialnumber";
-static const string CONFIG_EXPOSURE_TIME = "500d";
+// Time allowed to connect to the camera and for it to become ready. Adapted
+// to the 99th percentile of the connect latency, within these bounds.
+static const milliseconds READY_TIMEOUT_MIN{2000};
+static const milliseconds READY_TIMEOUT_MAX{15000};
+// Connects measured before the timeout is adapted
+static const unsigned int CONNECT_SAMPLES_MIN = 10;
+
+// Timeout of each wait for events while probing for readiness
+static const milliseconds READY_POLL_INTERVAL{100};
+// Wait between failed connection attempts
+static const milliseconds CONNECT_RETRY_INTERVAL{250};
+
+// Max number of pending events handled before each capture
+static const unsigned int MAX_PENDING_EVENTS = 16;
+
+// Wake up this long before closing a BULB exposure, the trigger then waits
+// for the exact time
+static const milliseconds BULB_WAKE_MARGIN{20};
+
+// Interval between the progress logs of a BULB exposure
+static const milliseconds BULB_PROGRESS_INTERVAL{30000};
+
+// Number of BULB exposures whose timing is kept
+static const unsigned int EXPOSURE_HISTORY_SIZE = 64;
+
+/**
+ * Times at which the camera received the IR triggers of a BULB exposure.
+ */
+struct ExposureTiming
+{
+    steady_clock::time_point open;
+    steady_clock::time_point close;
+    system_clock::time_point open_wall;  // Wall clock time of the opening
+    milliseconds requested{0};
+};
 
 class CameraWrapper
 {
@@ -31,6 +83,18 @@ public:
     CameraWrapper(CameraWrapper const&) = delete;
     void operator=(CameraWrapper const&) = delete;
 
+    /**
+     * Replaces the backend used to talk with the camera.
+     * Disconnects the current camera, if connected.
+     * @param backend The new backend. CameraWrapper takes ownership of it.
+     */
+    void setBackend(CameraBackend* backend);
+
+    /**
+     * Connects to the camera and waits until it is ready for captures.
+     * Retries until the ready timeout expires.
+     * @return True if connected
+     */
     bool connect();
     void disconnect();
 
@@ -42,17 +106,32 @@ public:
     
     bool capture(int exposure_time, string download_folder = "");
 
+    /**
+     * Takes an exposure without downloading it.
+     * @param exposure_time Exposure time in ms, only used in BULB mode
+     * @param path Path of the captured file on the camera
+     * @return True if success
+     */
+    bool capture(int exposure_time, CameraFilePath& path);
+
     bool wiredCapture();
 
     bool wiredCapture(CameraFilePath& path);
 
     bool remoteCapture(int exposure_time, CameraFilePath& path);
 
+    /**
+     * Timing of the last EXPOSURE_HISTORY_SIZE BULB exposures taken with
+     * remoteCapture(), oldest first.
+     */
+    vector<ExposureTiming> getExposures();
+
     bool downloadFile(CameraFilePath path, string destination);
 
     /**
      * Gets the value of a config of type text.
      * Use gphoto2 --list-config to view the available configs.
+     * The value is read from the config cache if available.
      * @param config The config name. Ex:/main/status/serialnumber -->
      * serialnumber
      * @return The config value, or an empty string if there was an error.
@@ -88,20 +167,119 @@ public:
      */
     vector<int> listAvailableExposureTimes();
 
+    /**
+     * Reads the events the camera reported since the last wait, without
+     * blocking, so that config changes are noticed between captures.
+     * Each event costs a USB transaction: only call it while idle, never
+     * right before a capture.
+     */
+    void pollEvents();
+
+    ConfigCache& getConfigCache() { return config_cache; }
+
+    CaptureStorage& getStorage() { return storage; }
+
 private:
     CameraWrapper();
     ~CameraWrapper();
 
     void freeCamera();
 
-    bool connected = false;
+    /**
+     * Waits until the camera stops reporting events and answers a config
+     * read.
+     * @return False if the deadline expired first
+     */
+    bool waitUntilReady(steady_clock::time_point deadline);
+
+    /**
+     * Updates the cached state after an event has been read from the camera.
+     * Every code path reading events must call it.
+     */
+    void onEvent(const CameraEvent& event);
+
+    /**
+     * Timing of an IR trigger, reported once the exposure is over.
+     */
+    struct TriggerReport
+    {
+        steady_clock::duration latency;  // From the start of the trigger
+        PlaybackReport playback;
+    };
+
+    /**
+     * Opens and closes a BULB exposure. Runs on the realtime thread, so it
+     * does not log, lock or record any stats.
+     * @param timing Requested length in, trigger times out
+     * @param reports Timing of the opening and closing triggers
+     */
+    void triggerExposure(ExposureTiming& timing, TriggerReport reports[2]);
+
+    /**
+     * Sends the IR trigger.
+     * @param at When the camera must receive the trigger
+     * @return When the camera actually received it
+     */
+    steady_clock::time_point fireTrigger(steady_clock::time_point at,
+                                         TriggerReport& report);
+
+    /**
+     * Records the stats and the history of a completed BULB exposure.
+     */
+    void onExposure(const ExposureTiming& timing,
+                    const TriggerReport reports[2]);
+
+    /**
+     * Logs when a BULB exposure was opened and how long it lasted.
+     */
+    void logExposure(const ExposureTiming& timing);
+
+    /**
+     * Initializes the camera, unless disconnect() was called meanwhile.
+     */
+    int initCamera();
+
+    /**
+     * @return Time allowed for the next connection, based on the measured
+     * connect latency
+     */
+    milliseconds connectTimeout();
+
+    /**
+     * Reads a config value from the camera, bypassing the cache.
+     */
+    string readConfigValue(string config_name);
+
+    atomic_bool connected{false};
 
     static int exposureTimeFromString(string exposure_time);
 
     string serial = NOT_A_GOOD_SERIAL;
 
-    Camera* camera = nullptr;
-    GPContext* context;
+    // Serializes connect()
+    mutex mtx_connect;
+
+    // Serializes the connection attempts and disconnect(), and guards serial
+    // and ready_timeout
+    mutex mtx_connection;
+
+    milliseconds ready_timeout = READY_TIMEOUT_MAX;
+    atomic_bool connect_cancelled{false};
+
+    // All the camera operations go through the worker thread, as they may be
+    // requested by the functions, the download pipeline and the commands at
+    // the same time
+    CameraWorker worker;
+
+    ConfigCache config_cache;
+
+    CaptureStorage storage;
+
+    // Opens and closes the shutter in BULB mode
+    RealtimeThread trigger_thread;
+
+    deque<ExposureTiming> exposures;
+    mutex mtx_exposures;
 };
 
 #endif /* SRC_CAMERA_CAMERA_H_ */
@@ -0,0 +1,156 @@
+#include "CaptureStorage.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "logger.h"
+
+using std::lock_guard;
+
+/**
+ * @return Folder of a path, with the trailing slash
+ */
+static string folderOf(const string& path)
+{
+    size_t slash = path.rfind('/');
+    return slash == string::npos ? "./" : path.substr(0, slash + 1);
+}
+
+void CaptureStorage::setConfig(StorageConfig new_config)
+{
+    // Don't leave files behind when leaving BATCHED mode
+    sync();
+
+    lock_guard<mutex> l(mtx);
+    config = new_config;
+}
+
+bool CaptureStorage::open(const string& path, size_t size, StorageFile& file)
+{
+    size_t slash = path.rfind('/');
+    string name  = slash == string::npos ? path : path.substr(slash + 1);
+
+    file.path     = path;
+    file.tmp_path = folderOf(path) + "." + name + ".part";
+    file.fd       = ::open(file.tmp_path.c_str(),
+                     O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file.fd < 0)
+    {
+        Log.e("Error opening file (%s): %s", file.tmp_path.c_str(),
+              std::strerror(errno));
+        return false;
+    }
+
+    // Reserve contiguous space, not every filesystem supports it
+    if (size > 0 && fallocate(file.fd, 0, 0, size) != 0)
+    {
+        Log.d("Cannot preallocate %s: %s", file.tmp_path.c_str(),
+              std::strerror(errno));
+    }
+    return true;
+}
+
+bool CaptureStorage::commit(StorageFile& file)
+{
+    SyncMode mode;
+    {
+        lock_guard<mutex> l(mtx);
+        mode = config.sync_mode;
+    }
+
+    // Drop the preallocated space that was not written
+    off_t written = lseek(file.fd, 0, SEEK_CUR);
+    if (written < 0 || ftruncate(file.fd, written) != 0)
+    {
+        Log.e("Error truncating file (%s): %s", file.tmp_path.c_str(),
+              std::strerror(errno));
+        discard(file);
+        return false;
+    }
+
+    if (mode == SyncMode::PER_FILE && fsync(file.fd) != 0)
+    {
+        Log.e("Error syncing file (%s): %s", file.tmp_path.c_str(),
+              std::strerror(errno));
+        discard(file);
+        return false;
+    }
+
+    int result = close(file.fd);
+    file.fd    = -1;
+    if (result != 0 || rename(file.tmp_path.c_str(), file.path.c_str()) != 0)
+    {
+        Log.e("Error saving file (%s): %s", file.path.c_str(),
+              std::strerror(errno));
+        discard(file);
+        return false;
+    }
+
+    if (mode == SyncMode::PER_FILE)
+    {
+        syncFolder(file.path);
+    }
+    else if (mode == SyncMode::BATCHED)
+    {
+        bool batch_full;
+        {
+            lock_guard<mutex> l(mtx);
+            unsynced_path = file.path;
+            batch_full    = ++unsynced >= config.sync_batch;
+        }
+        if (batch_full)
+        {
+            sync();
+        }
+    }
+    return true;
+}
+
+void CaptureStorage::discard(StorageFile& file)
+{
+    if (file.fd >= 0)
+    {
+        close(file.fd);
+        file.fd = -1;
+    }
+    unlink(file.tmp_path.c_str());
+}
+
+void CaptureStorage::sync()
+{
+    lock_guard<mutex> l(mtx);
+    if (unsynced == 0)
+    {
+        return;
+    }
+
+    // Flushes the data and the renames of every file in the batch at once
+    int fd = ::open(folderOf(unsynced_path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || syncfs(fd) != 0)
+    {
+        Log.e("Error syncing captures: %s", std::strerror(errno));
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    unsynced = 0;
+}
+
+void CaptureStorage::syncFolder(const string& path)
+{
+    int fd = ::open(folderOf(path).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fsync(fd) != 0)
+    {
+        Log.e("Error syncing folder of %s: %s", path.c_str(),
+              std::strerror(errno));
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
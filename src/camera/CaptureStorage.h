@@ -0,0 +1,87 @@
+#ifndef SRC_CAMERA_CAPTURESTORAGE_H
+#define SRC_CAMERA_CAPTURESTORAGE_H
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+using std::mutex;
+using std::string;
+
+enum class SyncMode
+{
+    NONE,      // Leave it to the kernel
+    PER_FILE,  // fsync every file before it is renamed into place
+    BATCHED    // Sync the filesystem every sync_batch files
+};
+
+struct StorageConfig
+{
+    SyncMode sync_mode      = SyncMode::BATCHED;
+    unsigned int sync_batch = 8;
+};
+
+/**
+ * File being written, not yet visible under its final name.
+ */
+struct StorageFile
+{
+    int fd = -1;
+    string path;      // Final path
+    string tmp_path;  // Path while writing
+};
+
+/**
+ * Writes downloaded captures so that a file only appears under its final name
+ * once complete: data goes to a hidden temporary file in the same folder,
+ * preallocated when the size is known to limit fragmentation, which is then
+ * renamed.
+ * How often the data is flushed to the disk depends on the sync mode.
+ */
+class CaptureStorage
+{
+public:
+    CaptureStorage(StorageConfig config = StorageConfig()) : config(config) {}
+    ~CaptureStorage() { sync(); }
+
+    void setConfig(StorageConfig config);
+
+    /**
+     * Creates the temporary file for a capture.
+     * @param path Final path of the file
+     * @param size Expected size of the file, 0 if unknown
+     * @return False if the file could not be created
+     */
+    bool open(const string& path, size_t size, StorageFile& file);
+
+    /**
+     * Closes the file and gives it its final name.
+     * @return False on error, in which case the file is deleted
+     */
+    bool commit(StorageFile& file);
+
+    /**
+     * Closes and deletes the file.
+     */
+    void discard(StorageFile& file);
+
+    /**
+     * Flushes the files not synced yet in BATCHED mode.
+     */
+    void sync();
+
+private:
+    /**
+     * Syncs the folder containing path, to persist a rename.
+     */
+    static void syncFolder(const string& path);
+
+    StorageConfig config;
+
+    // Guards the members below: files may be committed from several threads
+    mutex mtx;
+    unsigned int unsynced = 0;
+    string unsynced_path;  // Any file on the filesystem to sync
+};
+
+#endif /* SRC_CAMERA_CAPTURESTORAGE_H */
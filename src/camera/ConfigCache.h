@@ -0,0 +1,157 @@
+#ifndef SRC_CAMERA_CONFIGCACHE_H
+#define SRC_CAMERA_CONFIGCACHE_H
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+
+#include "logger.h"
+
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::string;
+using std::vector;
+
+using json = nlohmann::json;
+
+/**
+ * Stores the decoded values and choice lists of the camera configs, to avoid
+ * a USB round trip every time a config is read.
+ * Values marked as static (eg: the serial number) and choice lists are only
+ * dropped by invalidateAll().
+ */
+class ConfigCache
+{
+public:
+    bool getValue(const string& config_name, string& value)
+    {
+        lock_guard<mutex> l(mtx);
+        auto it = entries.find(config_name);
+        if (it != entries.end() && it->second.has_value)
+        {
+            hits++;
+            value = it->second.value;
+            return true;
+        }
+        misses++;
+        return false;
+    }
+
+    void putValue(const string& config_name, const string& value,
+                  bool is_static = false)
+    {
+        lock_guard<mutex> l(mtx);
+        Entry& e    = entries[config_name];
+        e.value     = value;
+        e.has_value = true;
+        e.is_static = is_static;
+    }
+
+    bool getChoices(const string& config_name, vector<string>& choices)
+    {
+        lock_guard<mutex> l(mtx);
+        auto it = entries.find(config_name);
+        if (it != entries.end() && it->second.has_choices)
+        {
+            hits++;
+            choices = it->second.choices;
+            return true;
+        }
+        misses++;
+        return false;
+    }
+
+    void putChoices(const string& config_name, const vector<string>& choices)
+    {
+        lock_guard<mutex> l(mtx);
+        Entry& e      = entries[config_name];
+        e.choices     = choices;
+        e.has_choices = true;
+    }
+
+    /**
+     * Drops the value of a single config, eg: after it has been set.
+     */
+    void invalidate(const string& config_name)
+    {
+        lock_guard<mutex> l(mtx);
+        auto it = entries.find(config_name);
+        if (it != entries.end())
+        {
+            it->second.has_value = false;
+        }
+    }
+
+    /**
+     * Drops all the values that may have changed on the camera.
+     */
+    void invalidateValues()
+    {
+        lock_guard<mutex> l(mtx);
+        for (auto it = entries.begin(); it != entries.end(); it++)
+        {
+            if (!it->second.is_static)
+            {
+                it->second.has_value = false;
+            }
+        }
+    }
+
+    /**
+     * Drops everything, eg: when the camera is disconnected.
+     */
+    void invalidateAll()
+    {
+        lock_guard<mutex> l(mtx);
+        entries.clear();
+    }
+
+    unsigned int hitCount() const { return hits; }
+    unsigned int missCount() const { return misses; }
+
+    /**
+     * @return Percentage of the reads served from the cache
+     */
+    int hitRate() const
+    {
+        unsigned int h = hits, m = misses;
+        return h + m > 0 ? (int)(h * 100ull / (h + m)) : 0;
+    }
+
+    void print() const
+    {
+        Log.i("Config cache: hits: %u, misses: %u, hit rate: %d%%",
+              hitCount(), missCount(), hitRate());
+    }
+
+    void statsToJson(json& j) const
+    {
+        j["hits"]     = hitCount();
+        j["misses"]   = missCount();
+        j["hit_rate"] = hitRate();
+    }
+
+private:
+    struct Entry
+    {
+        string value;
+        bool has_value = false;
+        bool is_static = false;
+
+        vector<string> choices;
+        bool has_choices = false;
+    };
+
+    mutex mtx;
+    map<string, Entry> entries;
+
+    // Read without the lock by the stats
+    std::atomic_uint hits{0};
+    std::atomic_uint misses{0};
+};
+
+#endif /* SRC_CAMERA_CONFIGCACHE_H */
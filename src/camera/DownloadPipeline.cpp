@@ -0,0 +1,67 @@
+#include "DownloadPipeline.h"
+
+#include <chrono>
+
+#include "logger.h"
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+DownloadPipeline::DownloadPipeline(CameraWrapper& camera, size_t queue_size)
+    : camera(camera), queue(queue_size)
+{
+    thread_download =
+        unique_ptr<thread>(new thread(&DownloadPipeline::run, this));
+}
+
+DownloadPipeline::~DownloadPipeline() { finish(); }
+
+bool DownloadPipeline::enqueue(const CameraFilePath& path, string destination)
+{
+    if (!queue.put({path, destination}))
+    {
+        Log.e("Download pipeline stopped, dropping %s", path.name);
+        return false;
+    }
+    return true;
+}
+
+void DownloadPipeline::finish()
+{
+    queue.close();
+
+    if (thread_download != nullptr && thread_download->joinable())
+    {
+        thread_download->join();
+    }
+}
+
+void DownloadPipeline::run()
+{
+    DownloadJob job;
+    while (queue.take(job))
+    {
+        auto download_start = steady_clock::now();
+        Log.d("Downloading...");
+        bool success = camera.downloadFile(job.path, job.destination);
+        auto download_end = steady_clock::now();
+
+        if (success)
+        {
+            downloaded++;
+            Log.i(
+                "Download complete. duration: %d ms, queued: %d",
+                (int)duration_cast<milliseconds>(download_end - download_start)
+                    .count(),
+                (int)queue.size());
+        }
+        else
+        {
+            failed++;
+            Log.e("Download failed.");
+        }
+    }
+    Log.d("Download pipeline terminated. Downloaded: %d, failed: %d",
+          (int)downloaded, (int)failed);
+}
@@ -0,0 +1,69 @@
+#ifndef SRC_CAMERA_DOWNLOADPIPELINE_H
+#define SRC_CAMERA_DOWNLOADPIPELINE_H
+
+#include <gphoto2/gphoto2-camera.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "CameraWrapper.h"
+#include "utils/BoundedQueue.h"
+
+using std::atomic_int;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+
+// Max number of captured files waiting to be downloaded
+static const unsigned int DOWNLOAD_QUEUE_SIZE = 4;
+
+/**
+ * Downloads captured files on a separate thread, so that the next exposure
+ * can start while the previous file is still being transferred.
+ * If the queue is full, enqueue() blocks until a download completes.
+ */
+class DownloadPipeline
+{
+public:
+    DownloadPipeline(CameraWrapper& camera,
+                     size_t queue_size = DOWNLOAD_QUEUE_SIZE);
+    ~DownloadPipeline();
+
+    /**
+     * Schedules the download of a captured file.
+     * @param path Path of the file on the camera
+     * @param destination Destination path on the local filesystem
+     * @return False if the pipeline has been stopped
+     */
+    bool enqueue(const CameraFilePath& path, string destination);
+
+    /**
+     * Stops accepting new files and waits until every pending download is
+     * complete.
+     */
+    void finish();
+
+    int downloadedCount() { return downloaded; }
+    int failedCount() { return failed; }
+
+private:
+    struct DownloadJob
+    {
+        CameraFilePath path;
+        string destination;
+    };
+
+    void run();
+
+    CameraWrapper& camera;
+    BoundedQueue<DownloadJob> queue;
+
+    atomic_int downloaded{0};
+    atomic_int failed{0};
+
+    unique_ptr<thread> thread_download;
+};
+
+#endif /* SRC_CAMERA_DOWNLOADPIPELINE_H */
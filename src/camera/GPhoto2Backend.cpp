@@ -0,0 +1,358 @@
+#include "GPhoto2Backend.h"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "logger.h"
+
+static const uint32_t CACHE_MAGIC = 0x43414d31;  // "CAM1"
+
+GPhoto2Backend::GPhoto2Backend(string cache_file)
+    : cache_file(cache_file), context(gp_context_new())
+{
+}
+
+GPhoto2Backend::~GPhoto2Backend()
+{
+    exit();
+    if (port_list != nullptr)
+    {
+        gp_port_info_list_free(port_list);
+    }
+    gp_context_unref(context);
+}
+
+int GPhoto2Backend::init()
+{
+    CachedCamera cached;
+    if (loadCache(cached))
+    {
+        int result = initCamera(&cached);
+        if (result == GP_OK)
+        {
+            string serial;
+            if (getConfigValue(CONFIG_SERIAL_NUMBER, serial) == GP_OK &&
+                serial == cached.serial)
+            {
+                Log.i("Using cached camera: %s on %s", cached.abilities.model,
+                      cached.port_path);
+                return GP_OK;
+            }
+            Log.w("Found a different camera, autodetecting.");
+            exit();
+        }
+        else
+        {
+            Log.w("Cannot use cached camera (%d), autodetecting.", result);
+        }
+    }
+
+    int result = initCamera(nullptr);
+    if (result == GP_OK)
+    {
+        saveCache();
+    }
+    return result;
+}
+
+int GPhoto2Backend::initCamera(const CachedCamera* cached)
+{
+    int result = gp_camera_new(&camera);
+
+    if (result != GP_OK)
+    {
+        Log.e("Error instantiating camera: %d", result);
+        camera = nullptr;
+        return result;
+    }
+
+    if (cached != nullptr)
+    {
+        GPPortInfo info;
+        result = findPort(cached->port_path, info);
+        if (result == GP_OK)
+        {
+            gp_camera_set_abilities(camera, cached->abilities);
+            result = gp_camera_set_port_info(camera, info);
+        }
+    }
+
+    if (result == GP_OK)
+    {
+        result = gp_camera_init(camera, context);
+    }
+
+    if (result != GP_OK)
+    {
+        gp_camera_free(camera);
+        camera = nullptr;
+    }
+    return result;
+}
+
+int GPhoto2Backend::findPort(const char* path, GPPortInfo& info)
+{
+    if (port_list == nullptr)
+    {
+        gp_port_info_list_new(&port_list);
+
+        int result = gp_port_info_list_load(port_list);
+        if (result < GP_OK)
+        {
+            gp_port_info_list_free(port_list);
+            port_list = nullptr;
+            return result;
+        }
+    }
+
+    int index = gp_port_info_list_lookup_path(port_list, path);
+    if (index < GP_OK)
+    {
+        return index;
+    }
+    return gp_port_info_list_get_info(port_list, index, &info);
+}
+
+bool GPhoto2Backend::loadCache(CachedCamera& cached)
+{
+    FILE* f = fopen(cache_file.c_str(), "rb");
+    if (f == NULL)
+    {
+        return false;
+    }
+
+    bool valid = fread(&cached, sizeof(cached), 1, f) == 1 &&
+                 cached.magic == CACHE_MAGIC &&
+                 cached.abilities_size == sizeof(CameraAbilities);
+    fclose(f);
+
+    if (valid)
+    {
+        // Don't trust the file
+        cached.serial[sizeof(cached.serial) - 1]       = '\0';
+        cached.port_path[sizeof(cached.port_path) - 1] = '\0';
+    }
+    return valid;
+}
+
+void GPhoto2Backend::saveCache()
+{
+    CachedCamera cached{};
+    cached.magic          = CACHE_MAGIC;
+    cached.abilities_size = sizeof(CameraAbilities);
+
+    string serial;
+    GPPortInfo info;
+    char* path;
+    if (gp_camera_get_abilities(camera, &cached.abilities) != GP_OK ||
+        gp_camera_get_port_info(camera, &info) != GP_OK ||
+        gp_port_info_get_path(info, &path) != GP_OK ||
+        getConfigValue(CONFIG_SERIAL_NUMBER, serial) != GP_OK)
+    {
+        Log.w("Cannot read the camera details, not caching them.");
+        return;
+    }
+    strncpy(cached.serial, serial.c_str(), sizeof(cached.serial) - 1);
+    strncpy(cached.port_path, path, sizeof(cached.port_path) - 1);
+
+    // Write a new file and replace the old one, so it is never left
+    // half written
+    string tmp_file = cache_file + ".tmp";
+    FILE* f         = fopen(tmp_file.c_str(), "wb");
+    if (f == NULL)
+    {
+        Log.w("Cannot write camera cache (%s): %s", tmp_file.c_str(),
+              std::strerror(errno));
+        return;
+    }
+    bool written = fwrite(&cached, sizeof(cached), 1, f) == 1;
+    written      = fclose(f) == 0 && written;
+
+    if (!written || rename(tmp_file.c_str(), cache_file.c_str()) != 0)
+    {
+        Log.w("Cannot write camera cache (%s)", cache_file.c_str());
+        remove(tmp_file.c_str());
+    }
+}
+
+void GPhoto2Backend::exit()
+{
+    if (camera != nullptr)
+    {
+        gp_camera_exit(camera, context);
+        gp_camera_free(camera);
+        camera = nullptr;
+    }
+}
+
+int GPhoto2Backend::capture(CameraFilePath& path)
+{
+    return gp_camera_capture(camera, GP_CAPTURE_IMAGE, &path, context);
+}
+
+int GPhoto2Backend::getFile(const CameraFilePath& path, int fd)
+{
+    CameraFile* file;
+
+    // gp_file_free() closes fd
+    int result = gp_file_new_from_fd(&file, fd);
+    if (result != GP_OK)
+    {
+        Log.e("Error creating CameraFile: %d", result);
+        close(fd);
+        return result;
+    }
+
+    result = gp_camera_file_get(camera, path.folder, path.name,
+                                GP_FILE_TYPE_RAW, file, context);
+
+    gp_file_free(file);
+    return result;
+}
+
+int GPhoto2Backend::getFileSize(const CameraFilePath& path, size_t& size)
+{
+    CameraFileInfo info;
+
+    int result = gp_camera_file_get_info(camera, path.folder, path.name,
+                                         &info, context);
+    if (result != GP_OK)
+    {
+        return result;
+    }
+    if (!(info.file.fields & GP_FILE_INFO_SIZE))
+    {
+        return GP_ERROR_NOT_SUPPORTED;
+    }
+    size = info.file.size;
+    return GP_OK;
+}
+
+int GPhoto2Backend::waitForEvent(int timeout, CameraEventType& type,
+                                 CameraFilePath& file)
+{
+    void* data = nullptr;
+
+    int result =
+        gp_camera_wait_for_event(camera, timeout, &type, &data, context);
+
+    if (result == GP_OK && type == GP_EVENT_FILE_ADDED)
+    {
+        file = *((CameraFilePath*)data);
+    }
+    // Event data is allocated by libgphoto2 and owned by the caller
+    free(data);
+
+    return result;
+}
+
+int GPhoto2Backend::getConfigValue(const string& config_name, string& value)
+{
+    CameraWidget* widget;
+
+    int result = gp_camera_get_single_config(camera, config_name.c_str(),
+                                             &widget, context);
+    if (result != GP_OK)
+    {
+        return result;
+    }
+
+    const char* val;
+    result = gp_widget_get_value(widget, &val);
+
+    if (result != GP_OK)
+    {
+        Log.e("Couldn't get widget value (%s): %d", config_name.c_str(),
+              result);
+        goto out;
+    }
+    value = string(val);
+
+out:
+    gp_widget_free(widget);
+    return result;
+}
+
+int GPhoto2Backend::setConfigValue(const string& config_name,
+                                   const string& value)
+{
+    CameraWidget* widget;
+    int result = gp_camera_get_single_config(camera, config_name.c_str(),
+                                             &widget, context);
+    if (result != GP_OK)
+    {
+        return result;
+    }
+    CameraWidgetType type;
+    result = gp_widget_get_type(widget, &type);
+    if (result != GP_OK)
+    {
+        Log.e("Couldn't get config type (%s): %d", config_name.c_str(), result);
+        goto out;
+    }
+
+    switch (type)
+    {
+        case GP_WIDGET_MENU:
+        case GP_WIDGET_RADIO:
+        case GP_WIDGET_TEXT:
+        {
+            result = gp_widget_set_value(widget, value.c_str());
+            if (result != GP_OK)
+            {
+                Log.e("Couldn't set config value (%s): %d", config_name.c_str(),
+                      result);
+                goto out;
+            }
+            // Finally set the config on the camera
+            result = gp_camera_set_single_config(camera, config_name.c_str(),
+                                                 widget, context);
+            goto out;
+        }
+
+        default:
+            Log.e("Bad widget type (%s): %d", config_name.c_str(), type);
+            result = GP_ERROR_BAD_PARAMETERS;
+            goto out;
+    }
+
+out:
+    gp_widget_free(widget);
+    return result;
+}
+
+int GPhoto2Backend::listConfigChoices(const string& config_name,
+                                      vector<string>& choices)
+{
+    CameraWidget* widget;
+    int result = gp_camera_get_single_config(camera, config_name.c_str(),
+                                             &widget, context);
+    int n;
+
+    if (result != GP_OK)
+    {
+        return result;
+    }
+
+    n = gp_widget_count_choices(widget);
+
+    const char* ch;
+    for (int i = 0; i < n; i++)
+    {
+        result = gp_widget_get_choice(widget, i, &ch);
+        if (result != GP_OK)
+        {
+            Log.e("Couldn't get choice (%s): %d", config_name.c_str(), result);
+            goto out;
+        }
+        choices.push_back(string(ch));
+    }
+
+out:
+    gp_widget_free(widget);
+    return result;
+}
@@ -0,0 +1,79 @@
+#ifndef SRC_CAMERA_GPHOTO2BACKEND_H
+#define SRC_CAMERA_GPHOTO2BACKEND_H
+
+#include <gphoto2/gphoto2.h>
+
+#include <cstdint>
+#include <string>
+
+#include "CameraBackend.h"
+
+using std::string;
+
+// Stores the abilities and port of the last connected camera. Kept with the
+// rest of the controller state in the download folder (see
+// DEFAULT_DOWNLOAD_FOLDER), hidden so that it is never listed as a capture.
+static const string DEFAULT_CAMERA_CACHE_FILE =
+    "/home/pi/CCCaptures/.camera_cache.bin";
+
+/**
+ * Camera backend talking to a real camera through libgphoto2.
+ * Autodetecting the camera loads every camera driver and probes every port:
+ * the result is saved to disk and reused for the next connections, as long
+ * as the same camera (same serial number) is found.
+ */
+class GPhoto2Backend : public CameraBackend
+{
+public:
+    GPhoto2Backend(string cache_file = DEFAULT_CAMERA_CACHE_FILE);
+    ~GPhoto2Backend();
+
+    int init() override;
+    void exit() override;
+
+    int capture(CameraFilePath& path) override;
+    int getFile(const CameraFilePath& path, int fd) override;
+    int getFileSize(const CameraFilePath& path, size_t& size) override;
+    int waitForEvent(int timeout, CameraEventType& type,
+                     CameraFilePath& file) override;
+
+    int getConfigValue(const string& config_name, string& value) override;
+    int setConfigValue(const string& config_name,
+                       const string& value) override;
+    int listConfigChoices(const string& config_name,
+                          vector<string>& choices) override;
+
+private:
+    struct CachedCamera
+    {
+        uint32_t magic;
+        uint32_t abilities_size;  // Changes with the libgphoto2 version
+        char serial[64];
+        char port_path[128];
+        CameraAbilities abilities;
+    };
+
+    /**
+     * Creates and initializes the camera.
+     * @param cached Camera to connect to, nullptr to autodetect it
+     */
+    int initCamera(const CachedCamera* cached);
+
+    /**
+     * Finds a port by its path (eg: usb:001,005).
+     */
+    int findPort(const char* path, GPPortInfo& info);
+
+    bool loadCache(CachedCamera& cached);
+    void saveCache();
+
+    const string cache_file;
+
+    Camera* camera = nullptr;
+    GPContext* context;
+
+    // Loaded once, as it is needed to find the cached port
+    GPPortInfoList* port_list = nullptr;
+};
+
+#endif /* SRC_CAMERA_GPHOTO2BACKEND_H */
@@ -0,0 +1,240 @@
+#include "SimulatedBackend.h"
+
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#include "logger.h"
+
+using namespace std::this_thread;
+
+using std::find;
+using std::lock_guard;
+using std::min;
+using std::chrono::milliseconds;
+
+static const char* SIM_FOLDER = "/store_00010001/DCIM/100SIMUL";
+
+SimulatedBackend::SimulatedBackend(SimulatedCameraConfig config)
+    : config(config), exposure_time(config.exposure_time)
+{
+}
+
+int SimulatedBackend::init()
+{
+    sleep_for(milliseconds(config.init_latency));
+    {
+        lock_guard<mutex> l(mtx_events);
+        initialized = true;
+        bulb_open   = false;
+        events.clear();
+    }
+
+    Log.i("Simulated camera initialized (%s)", config.serial.c_str());
+    return GP_OK;
+}
+
+void SimulatedBackend::exit()
+{
+    lock_guard<mutex> l(mtx_events);
+    initialized = false;
+}
+
+CameraFilePath SimulatedBackend::nextFilePath()
+{
+    CameraFilePath path{};
+    snprintf(path.folder, sizeof(path.folder), "%s", SIM_FOLDER);
+    snprintf(path.name, sizeof(path.name), "SIM_%04u.NEF", ++file_counter);
+    return path;
+}
+
+int SimulatedBackend::capture(CameraFilePath& path)
+{
+    if (!initialized)
+    {
+        return GP_ERROR_CAMERA_BUSY;
+    }
+    if (isBulb())
+    {
+        // Real cameras refuse to capture over USB in BULB mode
+        return GP_ERROR_NOT_SUPPORTED;
+    }
+
+    // Exposure time config is expressed in tenths of milliseconds
+    int exposure_ms = std::stoi(exposure_time) / 10;
+    sleep_for(milliseconds(exposure_ms + config.capture_latency));
+
+    lock_guard<mutex> l(mtx_events);
+    path = nextFilePath();
+    return GP_OK;
+}
+
+int SimulatedBackend::getFile(const CameraFilePath& path, int fd)
+{
+    if (!initialized)
+    {
+        close(fd);
+        return GP_ERROR_CAMERA_BUSY;
+    }
+
+    // Write the file in 1 ms worth of data at a time, to model the transfer
+    // rate
+    const size_t chunk_size = std::max(config.download_rate, 1);
+    vector<uint8_t> chunk(chunk_size, 0);
+
+    auto next_chunk = steady_clock::now();
+    size_t written  = 0;
+
+    while (written < config.file_size)
+    {
+        size_t sz = min(chunk_size, config.file_size - written);
+        if (write(fd, chunk.data(), sz) != (ssize_t)sz)
+        {
+            Log.e("Simulated download of %s failed: %s", path.name,
+                  strerror(errno));
+            close(fd);
+            return GP_ERROR_IO_WRITE;
+        }
+        written += sz;
+
+        next_chunk += milliseconds(1);
+        sleep_until(next_chunk);
+    }
+
+    // Like gp_file_free() on a CameraFile created from fd
+    close(fd);
+    return GP_OK;
+}
+
+int SimulatedBackend::getFileSize(const CameraFilePath&, size_t& size)
+{
+    if (!initialized)
+    {
+        return GP_ERROR_CAMERA_BUSY;
+    }
+    size = config.file_size;
+    return GP_OK;
+}
+
+int SimulatedBackend::waitForEvent(int timeout, CameraEventType& type,
+                                   CameraFilePath& file)
+{
+    if (!initialized)
+    {
+        return GP_ERROR_CAMERA_BUSY;
+    }
+
+    auto deadline = steady_clock::now() + milliseconds(std::max(timeout, 0));
+
+    // Poll the event queue, as new events may be added while waiting
+    while (true)
+    {
+        {
+            lock_guard<mutex> l(mtx_events);
+            auto now = steady_clock::now();
+            if (!events.empty() && events.front().time <= now)
+            {
+                type = events.front().type;
+                file = events.front().file;
+                events.pop_front();
+                return GP_OK;
+            }
+            if (now >= deadline)
+            {
+                type = GP_EVENT_TIMEOUT;
+                return GP_OK;
+            }
+        }
+        sleep_for(milliseconds(1));
+    }
+}
+
+int SimulatedBackend::getConfigValue(const string& config_name, string& value)
+{
+    if (!initialized)
+    {
+        return GP_ERROR_CAMERA_BUSY;
+    }
+
+    sleep_for(milliseconds(config.config_latency));
+
+    if (config_name == CONFIG_SERIAL_NUMBER)
+    {
+        value = config.serial;
+    }
+    else if (config_name == CONFIG_EXPOSURE_TIME)
+    {
+        lock_guard<mutex> l(mtx_events);
+        value = exposure_time;
+    }
+    else
+    {
+        return GP_ERROR_NOT_SUPPORTED;
+    }
+    return GP_OK;
+}
+
+int SimulatedBackend::setConfigValue(const string& config_name,
+                                     const string& value)
+{
+    if (!initialized)
+    {
+        return GP_ERROR_CAMERA_BUSY;
+    }
+
+    sleep_for(milliseconds(config.config_latency));
+
+    if (config_name != CONFIG_EXPOSURE_TIME)
+    {
+        return GP_ERROR_NOT_SUPPORTED;
+    }
+
+    if (find(config.exposure_choices.begin(), config.exposure_choices.end(),
+             value) == config.exposure_choices.end())
+    {
+        return GP_ERROR_BAD_PARAMETERS;
+    }
+    lock_guard<mutex> l(mtx_events);
+    exposure_time = value;
+    return GP_OK;
+}
+
+int SimulatedBackend::listConfigChoices(const string& config_name,
+                                        vector<string>& choices)
+{
+    if (!initialized)
+    {
+        return GP_ERROR_CAMERA_BUSY;
+    }
+
+    sleep_for(milliseconds(config.config_latency));
+
+    if (config_name != CONFIG_EXPOSURE_TIME)
+    {
+        return GP_ERROR_NOT_SUPPORTED;
+    }
+    choices = config.exposure_choices;
+    return GP_OK;
+}
+
+void SimulatedBackend::onRemoteTrigger()
+{
+    lock_guard<mutex> l(mtx_events);
+    if (!initialized || !isBulb())
+    {
+        return;
+    }
+
+    bulb_open = !bulb_open;
+
+    if (!bulb_open)
+    {
+        auto now = steady_clock::now();
+        events.push_back({now + milliseconds(config.capture_latency),
+                          GP_EVENT_CAPTURE_COMPLETE, CameraFilePath{}});
+        events.push_back({now + milliseconds(config.file_added_delay),
+                          GP_EVENT_FILE_ADDED, nextFilePath()});
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef SRC_CAMERA_SIMULATEDBACKEND_H
+#define SRC_CAMERA_SIMULATEDBACKEND_H
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+
+#include "CameraBackend.h"
+
+using std::deque;
+using std::mutex;
+using std::chrono::steady_clock;
+
+/**
+ * Timing parameters of the simulated camera. All times are in milliseconds.
+ */
+struct SimulatedCameraConfig
+{
+    string serial = "SIMULATED0001";
+
+    // Initial exposure time, as a value of the CONFIG_EXPOSURE_TIME config.
+    // "-1" is BULB.
+    string exposure_time = "-1";
+
+    vector<string> exposure_choices = {"-1",  "1",    "3",    "10",  "40",
+                                       "100", "400",  "1000", "2500", "10000",
+                                       "30000"};
+
+    int init_latency      = 500;
+    int config_latency    = 5;  // For every config read or write
+    int capture_latency   = 200;  // Shutter lag + processing after exposure
+    int file_added_delay  = 300;  // From end of BULB to GP_EVENT_FILE_ADDED
+    size_t file_size      = 25 * 1024 * 1024;  // Bytes
+    int download_rate     = 20 * 1024;         // Bytes per millisecond
+};
+
+/**
+ * In-process camera that models capture latency, BULB exposures triggered by
+ * the IR remote, file sizes and event timing. Lets the Sequencer and the
+ * Intervalometer run without a camera attached.
+ */
+class SimulatedBackend : public CameraBackend
+{
+public:
+    SimulatedBackend(SimulatedCameraConfig config = SimulatedCameraConfig());
+
+    int init() override;
+    void exit() override;
+
+    int capture(CameraFilePath& path) override;
+    int getFile(const CameraFilePath& path, int fd) override;
+    int getFileSize(const CameraFilePath& path, size_t& size) override;
+    int waitForEvent(int timeout, CameraEventType& type,
+                     CameraFilePath& file) override;
+
+    int getConfigValue(const string& config_name, string& value) override;
+    int setConfigValue(const string& config_name,
+                       const string& value) override;
+    int listConfigChoices(const string& config_name,
+                          vector<string>& choices) override;
+
+    void onRemoteTrigger() override;
+
+private:
+    struct PendingEvent
+    {
+        steady_clock::time_point time;
+        CameraEventType type;
+        CameraFilePath file;
+    };
+
+    bool isBulb() { return exposure_time == "-1"; }
+
+    CameraFilePath nextFilePath();
+
+    const SimulatedCameraConfig config;
+
+    // Guards the members below, as onRemoteTrigger() can be called at any time
+    mutex mtx_events;
+    bool initialized = false;
+    string exposure_time;
+    unsigned int file_counter = 0;
+    bool bulb_open = false;
+    deque<PendingEvent> events;
+};
+
+#endif /* SRC_CAMERA_SIMULATEDBACKEND_H */
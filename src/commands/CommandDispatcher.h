@@ -0,0 +1,190 @@
+#ifndef SRC_COMMANDS_COMMANDDISPATCHER_H
+#define SRC_COMMANDS_COMMANDDISPATCHER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "CommandExecutor.h"
+#include "Commands.h"
+#include "logger.h"
+
+/**
+ * Decodes commands and submits them to the executor, to be passed to the
+ * listener method for their id with the priority of the command. Both are
+ * found through a table indexed by command id built at compile time.
+ */
+class CommandDispatcher
+{
+public:
+    /**
+     * @param client Socket of the client that sent the command
+     * @return False if the command could not be decoded
+     */
+    static bool dispatchJson(const json& j, int client,
+                             CommandExecutor& executor)
+    {
+        uint8_t cmd_id;
+        try
+        {
+            cmd_id = j.at(KEY_CMDID).get<uint8_t>();
+        }
+        catch (std::exception& e)
+        {
+            Log.e(e.what());
+            return false;
+        }
+
+        const Entry& entry = TABLE.entries[cmd_id];
+        if (entry.json == nullptr)
+        {
+            Log.w("Unrecognized command: %d", cmd_id);
+            return false;
+        }
+        return entry.json(cmd_id, j, client, executor);
+    }
+
+    /**
+     * @param client Socket of the client that sent the command
+     * @return False if the command could not be decoded
+     */
+    static bool dispatchBinary(const uint8_t* data, size_t size, int client,
+                               CommandExecutor& executor)
+    {
+        if (size < 1)
+        {
+            Log.e("Empty binary telecommand.");
+            return false;
+        }
+
+        uint8_t cmd_id     = data[0];
+        const Entry& entry = TABLE.entries[cmd_id];
+        if (entry.binary == nullptr)
+        {
+            Log.w("Unrecognized command: %d", cmd_id);
+            return false;
+        }
+        return entry.binary(cmd_id, data + 1, size - 1, client, executor);
+    }
+
+private:
+    CommandDispatcher() {}
+
+    typedef bool (*JsonFn)(uint8_t, const json&, int, CommandExecutor&);
+    typedef bool (*BinaryFn)(uint8_t, const uint8_t*, size_t, int,
+                             CommandExecutor&);
+
+    struct Entry
+    {
+        JsonFn json              = nullptr;
+        BinaryFn binary          = nullptr;
+        CommandPriority priority = CMD_PRIORITY_NORMAL;
+    };
+
+    struct Table
+    {
+        Entry entries[256];
+    };
+
+    template <typename T, bool (CommandListener::*Handler)(const T&)>
+    static bool dispatchJson(uint8_t cmd_id, const json& j, int client,
+                             CommandExecutor& executor)
+    {
+        T cmd;
+        cmd.cmd_id = cmd_id;
+        cmd.client = client;
+        try
+        {
+            cmd.readJson(j);
+        }
+        catch (std::exception& e)
+        {
+            Log.e(e.what());
+            return false;
+        }
+
+        return submit<T, Handler>(cmd, executor);
+    }
+
+    template <typename T, bool (CommandListener::*Handler)(const T&)>
+    static bool dispatchBinary(uint8_t cmd_id, const uint8_t* args,
+                               size_t size, int client,
+                               CommandExecutor& executor)
+    {
+        T cmd;
+        cmd.cmd_id = cmd_id;
+        cmd.client = client;
+        if (!cmd.readBinary(args, size))
+        {
+            return false;
+        }
+
+        return submit<T, Handler>(cmd, executor);
+    }
+
+    template <typename T, bool (CommandListener::*Handler)(const T&)>
+    static bool submit(const T& cmd, CommandExecutor& executor)
+    {
+        return executor.submit(cmd, TABLE.entries[cmd.cmd_id].priority,
+                               &invoke<T, Handler>);
+    }
+
+    /**
+     * Called by the executor with the copy of the command it queued.
+     */
+    template <typename T, bool (CommandListener::*Handler)(const T&)>
+    static bool invoke(CommandListener& listener, const void* cmd)
+    {
+        return (listener.*Handler)(*static_cast<const T*>(cmd));
+    }
+
+    template <typename T, bool (CommandListener::*Handler)(const T&)>
+    static constexpr Entry entry(
+        CommandPriority priority = CMD_PRIORITY_NORMAL)
+    {
+        Entry e{};
+        e.json     = &dispatchJson<T, Handler>;
+        e.binary   = &dispatchBinary<T, Handler>;
+        e.priority = priority;
+        return e;
+    }
+
+    static constexpr Table makeTable()
+    {
+        typedef CommandListener L;
+
+        // clang-format off
+        Table t{};
+        t.entries[CMD_ID_SHUTDOWN]                = entry<Command, &L::onShutdown>(CMD_PRIORITY_LOW);
+        t.entries[CMD_ID_REBOOT]                  = entry<Command, &L::onReboot>(CMD_PRIORITY_LOW);
+
+        t.entries[CMD_ID_FUNCTIONSTART]           = entry<Command, &L::onFunctionStart>();
+        t.entries[CMD_ID_FUNCTIONSTOP]            = entry<Command, &L::onFunctionStop>(CMD_PRIORITY_URGENT);
+
+        t.entries[CMD_ID_CAMERA_TEST_CONNECTION]  = entry<Command, &L::onCameraTestConnection>(CMD_PRIORITY_LOW);
+        t.entries[CMD_ID_CAMERA_RECONNECT]        = entry<Command, &L::onCameraReconnect>(CMD_PRIORITY_LOW);
+
+        t.entries[CMD_ID_PIPELINED_DOWNLOAD]      = entry<PipelinedDownloadCommand, &L::onPipelinedDownload>();
+        t.entries[CMD_ID_FUNCTION_TEST_CAPTURE]   = entry<Command, &L::onFunctionTestCapture>();
+        t.entries[CMD_ID_DOWNLOAD_AFTER_EXPOSURE] = entry<DownloadAfterExposureCommand, &L::onDownloadAfterExposure>();
+
+        t.entries[CMD_ID_SEQUENCERSETUP]          = entry<SequencerSetupCommand, &L::onSequencerSetup>();
+        t.entries[CMD_ID_INTERVALOMETERSETUP]     = entry<IntervalometerSetupCommand, &L::onIntervalometerSetup>();
+
+        t.entries[CMD_ID_GET_TIMING_STATS]        = entry<Command, &L::onGetTimingStats>(CMD_PRIORITY_URGENT);
+        t.entries[CMD_ID_RESET_TIMING_STATS]      = entry<Command, &L::onResetTimingStats>(CMD_PRIORITY_URGENT);
+        t.entries[CMD_ID_GET_SERVER_STATS]        = entry<Command, &L::onGetServerStats>(CMD_PRIORITY_URGENT);
+        t.entries[CMD_ID_GET_EXPOSURES]           = entry<Command, &L::onGetExposures>(CMD_PRIORITY_URGENT);
+
+        t.entries[CMD_ID_FILE_DOWNLOAD]           = entry<FileDownloadCommand, &L::onFileDownload>();
+        t.entries[CMD_ID_FILE_ABORT]              = entry<Command, &L::onFileAbort>(CMD_PRIORITY_URGENT);
+        t.entries[CMD_ID_STORAGE_SETUP]           = entry<StorageSetupCommand, &L::onStorageSetup>();
+        // clang-format on
+
+        return t;
+    }
+
+    // Built by makeTable() at compile time, see Commands.cpp
+    static const Table TABLE;
+};
+
+#endif /* SRC_COMMANDS_COMMANDDISPATCHER_H */
@@ -0,0 +1,125 @@
+#include "CommandExecutor.h"
+
+#include "logger.h"
+
+using std::lock_guard;
+using std::unique_lock;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+
+CommandExecutor::CommandExecutor(CommandListener& listener, AckCallback on_ack)
+    : listener(listener), on_ack(on_ack)
+{
+    thread_urgent = unique_ptr<thread>(
+        new thread(&CommandExecutor::run, this, true));
+    thread_normal = unique_ptr<thread>(
+        new thread(&CommandExecutor::run, this, false));
+}
+
+CommandExecutor::~CommandExecutor()
+{
+    {
+        lock_guard<mutex> l(mtx_queues);
+        stopped = true;
+    }
+    cv_urgent.notify_all();
+    cv_normal.notify_all();
+
+    thread_urgent->join();
+    thread_normal->join();
+}
+
+bool CommandExecutor::submit(Job& job, CommandPriority priority)
+{
+    CommandAck ack{};
+    {
+        lock_guard<mutex> l(mtx_queues);
+        ack.seq    = ++seq;
+        ack.cmd_id = job.cmd_id;
+        ack.client = job.client;
+
+        JobQueue& q = queues[priority];
+        if (q.count < COMMAND_QUEUE_SIZE)
+        {
+            job.seq       = ack.seq;
+            job.submitted = steady_clock::now();
+
+            q.jobs[(q.first + q.count) % COMMAND_QUEUE_SIZE] = job;
+            q.count++;
+
+            // Tell the client the sequence number of the command before it
+            // can run, so that the acks arrive in order
+            ack.accepted = true;
+            on_ack(ack);
+        }
+        else
+        {
+            ack.rejected = true;
+        }
+    }
+
+    if (ack.rejected)
+    {
+        Log.e("Too many commands queued, discarding command %d", job.cmd_id);
+        on_ack(ack);
+        return false;
+    }
+
+    if (priority == CMD_PRIORITY_URGENT)
+    {
+        cv_urgent.notify_one();
+    }
+    else
+    {
+        cv_normal.notify_one();
+    }
+    return true;
+}
+
+bool CommandExecutor::takeJob(bool urgent, Job& job)
+{
+    unique_lock<mutex> l(mtx_queues);
+    condition_variable& cv = urgent ? cv_urgent : cv_normal;
+
+    int first = urgent ? CMD_PRIORITY_URGENT : CMD_PRIORITY_NORMAL;
+    int last  = urgent ? CMD_PRIORITY_URGENT : CMD_PRIORITY_LOW;
+
+    while (!stopped)
+    {
+        for (int p = first; p <= last; p++)
+        {
+            JobQueue& q = queues[p];
+            if (q.count > 0)
+            {
+                job     = q.jobs[q.first];
+                q.first = (q.first + 1) % COMMAND_QUEUE_SIZE;
+                q.count--;
+                return true;
+            }
+        }
+        cv.wait(l);
+    }
+    return false;
+}
+
+void CommandExecutor::run(bool urgent)
+{
+    Job job;
+    while (takeJob(urgent, job))
+    {
+        auto start = steady_clock::now();
+        bool success = job.handler(listener, &job.cmd);
+        auto end = steady_clock::now();
+
+        CommandAck ack{};
+        ack.seq     = job.seq;
+        ack.cmd_id  = job.cmd_id;
+        ack.client  = job.client;
+        ack.success = success;
+        ack.wait_us =
+            duration_cast<microseconds>(start - job.submitted).count();
+        ack.run_us = duration_cast<microseconds>(end - start).count();
+
+        on_ack(ack);
+    }
+}
@@ -0,0 +1,149 @@
+#ifndef SRC_COMMANDS_COMMANDEXECUTOR_H
+#define SRC_COMMANDS_COMMANDEXECUTOR_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+#include "CommandListener.h"
+
+using std::condition_variable;
+using std::function;
+using std::mutex;
+using std::thread;
+using std::unique_ptr;
+using std::chrono::steady_clock;
+
+enum CommandPriority : uint8_t
+{
+    // Quick commands that must not wait for the others, eg: stopping a
+    // function. Run on their own thread.
+    CMD_PRIORITY_URGENT = 0,
+    CMD_PRIORITY_NORMAL,
+    // Commands that may block for a long time, eg: reconnecting the camera
+    CMD_PRIORITY_LOW,
+    CMD_PRIORITY_NUM
+};
+
+// Max number of commands waiting for each priority
+static const unsigned int COMMAND_QUEUE_SIZE = 16;
+
+// Max size of a decoded command, stored in the queue without allocating
+static const size_t COMMAND_SLOT_SIZE = 144;
+
+/**
+ * State of a command, sent back to the client that sent it: once when it is
+ * accepted or rejected, and again after it has been executed.
+ */
+struct CommandAck
+{
+    uint32_t seq;  // Incremented for every received command
+    uint8_t cmd_id;
+    int client;     // Socket of the client that sent the command
+    bool accepted;  // Queued, not executed yet
+    bool success;
+    bool rejected;  // The queue was full: the command was not executed
+
+    int64_t wait_us;  // Time spent in the queue
+    int64_t run_us;   // Time spent executing
+};
+
+/**
+ * Executes the received commands away from the network thread.
+ * Urgent commands have a dedicated thread, so they never wait for a slow
+ * one. The others run in order on a second thread, normal priority ones
+ * before low priority ones.
+ */
+class CommandExecutor
+{
+public:
+    /**
+     * Passes a queued command to its listener method.
+     * @param cmd The command, of the type expected by the handler
+     */
+    typedef bool (*Handler)(CommandListener& listener, const void* cmd);
+    typedef function<void(const CommandAck&)> AckCallback;
+
+    /**
+     * @param on_ack Called when a command is accepted or rejected, from the
+     * thread submitting it, and after it has been executed, from the executor
+     * threads
+     */
+    CommandExecutor(CommandListener& listener, AckCallback on_ack);
+    ~CommandExecutor();
+
+    /**
+     * Queues a copy of a command. Never blocks nor allocates.
+     * @return False if too many commands with the same priority are queued
+     */
+    template <typename T>
+    bool submit(const T& cmd, CommandPriority priority, Handler handler)
+    {
+        static_assert(sizeof(T) <= COMMAND_SLOT_SIZE,
+                      "Command larger than COMMAND_SLOT_SIZE");
+        static_assert(std::is_trivially_copyable<T>::value &&
+                          std::is_trivially_destructible<T>::value,
+                      "Commands are queued as plain data");
+
+        Job job;
+        job.cmd_id  = cmd.cmd_id;
+        job.client  = cmd.client;
+        job.handler = handler;
+        new (&job.cmd) T(cmd);
+
+        return submit(job, priority);
+    }
+
+private:
+    struct Job
+    {
+        uint32_t seq;
+        uint8_t cmd_id;
+        int client;
+        Handler handler;
+        steady_clock::time_point submitted;
+
+        std::aligned_storage<COMMAND_SLOT_SIZE>::type cmd;
+    };
+
+    /**
+     * Fixed size FIFO of jobs.
+     */
+    struct JobQueue
+    {
+        Job jobs[COMMAND_QUEUE_SIZE];
+        unsigned int first = 0;
+        unsigned int count = 0;
+    };
+
+    bool submit(Job& job, CommandPriority priority);
+
+    /**
+     * @param urgent Only take urgent jobs, or only the others
+     */
+    void run(bool urgent);
+
+    bool takeJob(bool urgent, Job& job);
+
+    CommandListener& listener;
+    AckCallback on_ack;
+
+    mutex mtx_queues;
+    condition_variable cv_urgent;
+    condition_variable cv_normal;
+    JobQueue queues[CMD_PRIORITY_NUM];
+    uint32_t seq = 0;
+    bool stopped = false;
+
+    unique_ptr<thread> thread_urgent;
+    unique_ptr<thread> thread_normal;
+};
+
+#endif /* SRC_COMMANDS_COMMANDEXECUTOR_H */
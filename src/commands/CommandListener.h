@@ -0,0 +1,39 @@
+#ifndef SRC_COMMANDS_COMMANDLISTENER_H
+#define SRC_COMMANDS_COMMANDLISTENER_H
+
+#include "Commands.h"
+
+/**
+ * Receives the decoded commands, with one method for each command id.
+ * Each method returns false if the command could not be executed.
+ */
+class CommandListener
+{
+public:
+    virtual ~CommandListener() {}
+
+    virtual bool onShutdown(const Command& cmd)             = 0;
+    virtual bool onReboot(const Command& cmd)               = 0;
+    virtual bool onFunctionStart(const Command& cmd)        = 0;
+    virtual bool onFunctionStop(const Command& cmd)         = 0;
+    virtual bool onCameraTestConnection(const Command& cmd) = 0;
+    virtual bool onCameraReconnect(const Command& cmd)      = 0;
+    virtual bool onFunctionTestCapture(const Command& cmd)  = 0;
+    virtual bool onGetTimingStats(const Command& cmd)       = 0;
+    virtual bool onResetTimingStats(const Command& cmd)     = 0;
+    virtual bool onGetServerStats(const Command& cmd)       = 0;
+    virtual bool onGetExposures(const Command& cmd)         = 0;
+    virtual bool onFileAbort(const Command& cmd)            = 0;
+
+    virtual bool onPipelinedDownload(const PipelinedDownloadCommand& cmd) = 0;
+    virtual bool onSequencerSetup(const SequencerSetupCommand& cmd)       = 0;
+    virtual bool onFileDownload(const FileDownloadCommand& cmd)           = 0;
+    virtual bool onStorageSetup(const StorageSetupCommand& cmd)           = 0;
+
+    virtual bool onDownloadAfterExposure(
+        const DownloadAfterExposureCommand& cmd) = 0;
+    virtual bool onIntervalometerSetup(
+        const IntervalometerSetupCommand& cmd) = 0;
+};
+
+#endif /* SRC_COMMANDS_COMMANDLISTENER_H */
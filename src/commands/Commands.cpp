@@ -4,110 +4,122 @@
  */
 
 #include "Commands.h"
+#include "CommandDispatcher.h"
 
-// clang-format off
+#include <stdexcept>
 
-const JsonCommandDecoder::DecoderMap JsonCommandDecoder::decoder_map = {
+constexpr CommandDispatcher::Table CommandDispatcher::TABLE =
+    CommandDispatcher::makeTable();
 
-    {CMD_ID_SHUTDOWN, JsonCommandDecoder::decodeEmptyCommand},
-    {CMD_ID_REBOOT, JsonCommandDecoder::decodeEmptyCommand},
-
-    {CMD_ID_FUNCTIONSTART, JsonCommandDecoder::decodeEmptyCommand},
-    {CMD_ID_FUNCTIONSTOP, JsonCommandDecoder::decodeEmptyCommand},
+void DownloadAfterExposureCommand::readJson(const json& j)
+{
+    download = j.at(KEY_DOWNLOAD).get<bool>();
+}
 
-	{CMD_ID_CAMERA_TEST_CONNECTION, JsonCommandDecoder::decodeEmptyCommand},
-	{CMD_ID_CAMERA_RECONNECT, JsonCommandDecoder::decodeEmptyCommand},
+bool DownloadAfterExposureCommand::readBinary(const uint8_t* args, size_t size)
+{
+    if (!checkSize(size, 1))
+        return false;
 
-	{CMD_ID_FUNCTION_TEST_CAPTURE, JsonCommandDecoder::decodeEmptyCommand},
-    {CMD_ID_DOWNLOAD_AFTER_EXPOSURE, JsonCommandDecoder::decodeDownloadAfterExposure},
+    download = args[0] != 0;
+    return true;
+}
 
-    {CMD_ID_SEQUENCERSETUP, JsonCommandDecoder::decodeSetupSequencer},
-    {CMD_ID_INTERVALOMETERSETUP, JsonCommandDecoder::decodeSetupIntervalometer}
+void PipelinedDownloadCommand::readJson(const json& j)
+{
+    pipelined = j.at(KEY_PIPELINED).get<bool>();
+}
 
-};
+bool PipelinedDownloadCommand::readBinary(const uint8_t* args, size_t size)
+{
+    if (!checkSize(size, 1))
+        return false;
 
-// clang-format on
+    pipelined = args[0] != 0;
+    return true;
+}
 
-bool JsonCommandDecoder::decodeEmptyCommand(Command** cmd, json& j)
+void SequencerSetupCommand::readJson(const json& j)
 {
-    Command* c = new Command();
+    num_exposures = j.at(KEY_NUM_EXPOSURES).get<int>();
+    exp_time      = j.at(KEY_EXPOSURE_TIME).get<int>();
+    download      = j.at(KEY_DOWNLOAD).get<bool>();
+}
 
-    try
-    {
-        c->cmd_id = j.at(KEY_CMDID).get<uint8_t>();
-    }
-    catch (std::exception& e)
-    {
-        delete c;
-        Log.e(e.what());
+bool SequencerSetupCommand::readBinary(const uint8_t* args, size_t size)
+{
+    if (!checkSize(size, 9))
         return false;
-    }
 
-    *cmd = c;
+    num_exposures = readInt32(args);
+    exp_time      = readInt32(args + 4);
+    download      = args[8] != 0;
     return true;
 }
 
-bool JsonCommandDecoder::decodeSetupSequencer(Command** cmd, json& j)
+void IntervalometerSetupCommand::readJson(const json& j)
 {
-    SequencerSetupCommand* c = new SequencerSetupCommand();
+    num_exposures = j.at(KEY_NUM_EXPOSURES).get<int>();
+    exp_time      = j.at(KEY_EXPOSURE_TIME).get<int>();
+    interval      = j.at(KEY_INTERVAL).get<int>();
+    download      = j.at(KEY_DOWNLOAD).get<bool>();
+    late_policy   = j.value(KEY_LATE_POLICY, 0);
+}
 
-    try
-    {
-        c->cmd_id        = j.at(KEY_CMDID).get<uint8_t>();
-        c->num_exposures = j.at(KEY_NUM_EXPOSURES).get<int>();
-        c->exp_time      = j.at(KEY_EXPOSURE_TIME).get<int>();
-        c->download      = j.at(KEY_DOWNLOAD).get<bool>();
-    }
-    catch (std::exception& e)
-    {
-        delete c;
-        Log.e(e.what());
+bool IntervalometerSetupCommand::readBinary(const uint8_t* args, size_t size)
+{
+    // Late policy is optional
+    if (size != 14 && !checkSize(size, 13))
         return false;
-    }
 
-    *cmd = c;
+    num_exposures = readInt32(args);
+    exp_time      = readInt32(args + 4);
+    interval      = readInt32(args + 8);
+    download      = args[12] != 0;
+    late_policy   = size == 14 ? args[13] : 0;
     return true;
 }
 
-bool JsonCommandDecoder::decodeSetupIntervalometer(Command** cmd, json& j)
+void FileDownloadCommand::readJson(const json& j)
 {
-    IntervalometerSetupCommand* c = new IntervalometerSetupCommand();
+    string file_name = j.value(KEY_FILE_NAME, "");
+    offset           = j.value(KEY_FILE_OFFSET, 0u);
+    checksum         = j.value(KEY_FILE_CHECKSUM, false);
 
-    try
+    if (file_name.size() >= FILE_NAME_MAX_LENGTH)
     {
-        c->cmd_id        = j.at(KEY_CMDID).get<uint8_t>();
-        c->num_exposures = j.at(KEY_NUM_EXPOSURES).get<int>();
-        c->exp_time      = j.at(KEY_EXPOSURE_TIME).get<int>();
-        c->interval      = j.at(KEY_INTERVAL).get<int>();
-        c->download      = j.at(KEY_DOWNLOAD).get<bool>();
+        throw std::length_error("File name too long: " + file_name);
     }
-    catch (std::exception& e)
+    strncpy(name, file_name.c_str(), FILE_NAME_MAX_LENGTH - 1);
+}
+
+bool FileDownloadCommand::readBinary(const uint8_t* args, size_t size)
+{
+    // Name is optional and not null terminated
+    if (size < 5 || size >= 5 + FILE_NAME_MAX_LENGTH)
     {
-        delete c;
-        Log.e(e.what());
+        Log.e("Bad binary command size (cmd: %d): %d", cmd_id, (int)size);
         return false;
     }
 
-    *cmd = c;
+    offset   = (uint32_t)readInt32(args);
+    checksum = args[4] != 0;
+    memcpy(name, args + 5, size - 5);
     return true;
 }
 
-bool JsonCommandDecoder::decodeDownloadAfterExposure(Command** cmd, json& j)
+void StorageSetupCommand::readJson(const json& j)
 {
-    DownloadAfterExposureCommand* c = new DownloadAfterExposureCommand();
+    sync_mode  = j.at(KEY_SYNC_MODE).get<uint8_t>();
+    sync_batch = j.value(KEY_SYNC_BATCH, 0u);
+}
 
-    try
-    {
-        c->cmd_id   = j.at(KEY_CMDID).get<uint8_t>();
-        c->download = j.at(KEY_DOWNLOAD).get<bool>();
-    }
-    catch (std::exception& e)
-    {
-        delete c;
-        Log.e(e.what());
+bool StorageSetupCommand::readBinary(const uint8_t* args, size_t size)
+{
+    if (!checkSize(size, 5))
         return false;
-    }
 
-    *cmd = c;
+    sync_mode  = args[0];
+    sync_batch = (uint32_t)readInt32(args + 1);
     return true;
 }
@@ -7,17 +7,16 @@
 #define SRC_COMMANDS_COMMANDS_H
 
 #include <cstdint>
+#include <cstring>
 #include <nlohmann/json.hpp>
 
-#include <functional>
-#include <map>
+#include <cstddef>
+#include <string>
 
 #include "logger.h"
 
 using json = nlohmann::json;
-using std::function;
-using std::map;
-using std::pair;
+using std::string;
 
 enum Commands : uint8_t
 {
@@ -30,11 +29,21 @@ enum Commands : uint8_t
     CMD_ID_CAMERA_TEST_CONNECTION = 9,
     CMD_ID_CAMERA_RECONNECT       = 10,
 
+    CMD_ID_PIPELINED_DOWNLOAD      = 17,
     CMD_ID_FUNCTION_TEST_CAPTURE   = 18,
     CMD_ID_DOWNLOAD_AFTER_EXPOSURE = 19,
 
     CMD_ID_SEQUENCERSETUP      = 20,
-    CMD_ID_INTERVALOMETERSETUP = 30
+    CMD_ID_INTERVALOMETERSETUP = 30,
+
+    CMD_ID_GET_TIMING_STATS   = 40,
+    CMD_ID_RESET_TIMING_STATS = 41,
+    CMD_ID_GET_SERVER_STATS   = 42,
+    CMD_ID_GET_EXPOSURES      = 43,
+
+    CMD_ID_FILE_DOWNLOAD = 50,
+    CMD_ID_FILE_ABORT    = 51,
+    CMD_ID_STORAGE_SETUP = 52
 };
 
 static const char* KEY_CMDID         = "cmd_id";
@@ -42,49 +51,133 @@ static const char* KEY_NUM_EXPOSURES = "num_exposures";
 static const char* KEY_EXPOSURE_TIME = "exposure_time";
 static const char* KEY_INTERVAL      = "interval";
 static const char* KEY_DOWNLOAD      = "download";
+static const char* KEY_PIPELINED     = "pipelined";
+static const char* KEY_LATE_POLICY   = "late_policy";
+static const char* KEY_FILE_NAME     = "name";
+static const char* KEY_FILE_OFFSET   = "offset";
+static const char* KEY_FILE_CHECKSUM = "checksum";
+static const char* KEY_SYNC_MODE     = "sync_mode";
+static const char* KEY_SYNC_BATCH    = "sync_batch";
+
+// Including the terminator
+static const unsigned int FILE_NAME_MAX_LENGTH = 128;
+
+class CommandDispatcher;
 
-class JsonCommandDecoder;
+/*
+ * Every command is decoded from a JSON telecommand (MSGTYPE_TELECOMMAND) or
+ * from a binary one (MSGTYPE_BINARY_TELECOMMAND), little endian:
+ *
+ *      1          0 <= N
+ * |CMD_ID|     ARGS...     |
+ *
+ * Arguments are described above readBinary() for each command, commands
+ * using the base Command have none.
+ */
 
 struct Command
 {
-    friend class JsonCommandDecoder;
+    friend class CommandDispatcher;
 
     uint8_t cmd_id = 0;
+    // Socket of the client that sent the command, set by the dispatcher
+    int client = -1;
 
     Command(uint8_t cmd_id) : cmd_id(cmd_id) {}
-    virtual ~Command() {}
 
-    virtual void toJson(json& j) { j[KEY_CMDID] = cmd_id; }
-
-    virtual void print() const { Log.i("CMD{cmd: %d, et: %d, d: %s}", cmd_id); }
+    // Commands are plain data, copied in the executor queue as they are: no
+    // virtual methods
+    void print() const { Log.i("CMD{cmd: %d}", cmd_id); }
 
 protected:
     Command() {}
+
+    /**
+     * Reads the arguments of the command.
+     * @throws std::exception if an argument is missing or has the wrong type
+     */
+    void readJson(const json&) {}
+
+    /**
+     * @return False if the arguments are not valid
+     */
+    bool readBinary(const uint8_t*, size_t size)
+    {
+        return checkSize(size, 0);
+    }
+
+    bool checkSize(size_t size, size_t expected) const
+    {
+        if (size != expected)
+        {
+            Log.e("Bad binary command size (cmd: %d): %d, expected %d", cmd_id,
+                  (int)size, (int)expected);
+            return false;
+        }
+        return true;
+    }
+
+    static int32_t readInt32(const uint8_t* buf)
+    {
+        return (int32_t)((uint32_t)buf[0] | (uint32_t)buf[1] << 8 |
+                         (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24);
+    }
 };
 
 struct DownloadAfterExposureCommand : public Command
 {
-    friend class JsonCommandDecoder;
+    friend class CommandDispatcher;
 
     bool download = false;
 
     DownloadAfterExposureCommand(bool download)
-        : Command(cmd_id), download(download)
+        : Command(CMD_ID_DOWNLOAD_AFTER_EXPOSURE), download(download)
     {
     }
 
-    void print() const override
+    void print() const
     {
         Log.i("DAE{cmd: %d, dwnld: %s}", cmd_id, download ? "true" : "false");
     }
 
 protected:
     DownloadAfterExposureCommand() : Command() {}
+
+    void readJson(const json& j);
+
+    // |DOWNLOAD (1)|
+    bool readBinary(const uint8_t* args, size_t size);
+};
+
+struct PipelinedDownloadCommand : public Command
+{
+    friend class CommandDispatcher;
+
+    bool pipelined = false;
+
+    PipelinedDownloadCommand(uint8_t cmd_id, bool pipelined)
+        : Command(cmd_id), pipelined(pipelined)
+    {
+    }
+
+    void print() const
+    {
+        Log.i("PDC{cmd: %d, pipelined: %s}", cmd_id,
+              pipelined ? "true" : "false");
+    }
+
+protected:
+    PipelinedDownloadCommand() : Command() {}
+
+    void readJson(const json& j);
+
+    // |PIPELINED (1)|
+    bool readBinary(const uint8_t* args, size_t size);
 };
 
 struct SequencerSetupCommand : public Command
 {
-    friend class JsonCommandDecoder;
+    friend class CommandDispatcher;
 
     int num_exposures = 0;
     int exp_time      = 0;
@@ -97,7 +190,7 @@ struct SequencerSetupCommand : public Command
     {
     }
 
-    void print() const override
+    void print() const
     {
         Log.i("SSC{cmd: %d, ne: %d, et: %d, d: %s}", cmd_id, num_exposures,
               exp_time, download ? "true" : "false");
@@ -105,73 +198,106 @@ struct SequencerSetupCommand : public Command
 
 protected:
     SequencerSetupCommand() : Command() {}
+
+    void readJson(const json& j);
+
+    // |NUM_EXP (4)|EXP_TIME (4)|DOWNLOAD (1)|
+    bool readBinary(const uint8_t* args, size_t size);
 };
 
 struct IntervalometerSetupCommand : public Command
 {
-    friend class JsonCommandDecoder;
+    friend class CommandDispatcher;
 
-    int num_exposures = 0;
-    int exp_time      = 0;
-    int interval      = 0;
-    bool download     = false;
+    int num_exposures   = 0;
+    int exp_time        = 0;
+    int interval        = 0;
+    bool download       = false;
+    uint8_t late_policy = 0;  // See LatePolicy. Optional, SHIFT by default
 
     IntervalometerSetupCommand(uint8_t cmd_id, int num_exposures, int exp_time,
-                               int interval, bool download = false)
+                               int interval, bool download = false,
+                               uint8_t late_policy = 0)
         : Command(cmd_id), num_exposures(num_exposures), exp_time(exp_time),
-          interval(interval), download(download)
+          interval(interval), download(download), late_policy(late_policy)
     {
     }
 
-    void print() const override
+    void print() const
     {
-        Log.i("ISC{cmd: %d, ne: %d, et: %d, int: %d, d: %s}", cmd_id,
-              num_exposures, exp_time, interval, download ? "true" : "false");
+        Log.i("ISC{cmd: %d, ne: %d, et: %d, int: %d, d: %s, lp: %d}", cmd_id,
+              num_exposures, exp_time, interval, download ? "true" : "false",
+              late_policy);
     }
 
 protected:
     IntervalometerSetupCommand() : Command() {}
+
+    void readJson(const json& j);
+
+    // |NUM_EXP (4)|EXP_TIME (4)|INTERVAL (4)|DOWNLOAD (1)|[LATE_POLICY (1)]|
+    bool readBinary(const uint8_t* args, size_t size);
 };
 
-class JsonCommandDecoder
+struct FileDownloadCommand : public Command
 {
-    typedef function<bool(Command**, json&)> Decoder;
-    typedef map<uint8_t, Decoder> DecoderMap;
+    friend class CommandDispatcher;
+
+    // Name of a file in the download folder. Empty for the latest capture.
+    char name[FILE_NAME_MAX_LENGTH] = {0};
+    // Offset to resume an interrupted transfer from
+    uint32_t offset = 0;
+    // Compute checksums, instead of sending the file without reading it
+    bool checksum = false;
+
+    FileDownloadCommand(uint8_t cmd_id, const char* file_name,
+                        uint32_t offset = 0, bool checksum = false)
+        : Command(cmd_id), offset(offset), checksum(checksum)
+    {
+        strncpy(name, file_name, FILE_NAME_MAX_LENGTH - 1);
+    }
 
-public:
-    static bool decode(Command** cmd, json& j)
+    void print() const
     {
-        try
-        {
-            uint8_t cmd_id = j.at(KEY_CMDID).get<uint8_t>();
-            if (decoder_map.count(cmd_id) >= 1)
-            {
-                return decoder_map.at(cmd_id)(cmd, j);
-            }
-            else
-            {
-                Log.w("Unrecognized command: %d", cmd_id);
-                return false;
-            }
-        }
-        catch (std::exception& e)
-        {
-            Log.e(e.what());
-            return false;
-        }
+        Log.i("FDC{cmd: %d, name: %s, offset: %u, crc: %s}", cmd_id, name,
+              offset, checksum ? "true" : "false");
     }
 
-private:
-    JsonCommandDecoder(){};
+protected:
+    FileDownloadCommand() : Command() {}
+
+    void readJson(const json& j);
+
+    // |OFFSET (4)|CHECKSUM (1)|NAME (0 to 127, not null terminated)|
+    bool readBinary(const uint8_t* args, size_t size);
+};
+
+struct StorageSetupCommand : public Command
+{
+    friend class CommandDispatcher;
 
-    static bool decodeEmptyCommand(Command** cmd, json& j);
+    uint8_t sync_mode   = 0;  // See SyncMode
+    uint32_t sync_batch = 0;  // Files per sync in BATCHED mode
 
-    static bool decodeSetupSequencer(Command** cmd, json& j);
-    static bool decodeSetupIntervalometer(Command** cmd, json& j);
+    StorageSetupCommand(uint8_t cmd_id, uint8_t sync_mode,
+                        uint32_t sync_batch = 0)
+        : Command(cmd_id), sync_mode(sync_mode), sync_batch(sync_batch)
+    {
+    }
+
+    void print() const
+    {
+        Log.i("STC{cmd: %d, mode: %d, batch: %u}", cmd_id, sync_mode,
+              sync_batch);
+    }
+
+protected:
+    StorageSetupCommand() : Command() {}
 
-    static bool decodeDownloadAfterExposure(Command** cmd, json& j);
+    void readJson(const json& j);
 
-    static const DecoderMap decoder_map;
+    // |SYNC_MODE (1)|SYNC_BATCH (4)|
+    bool readBinary(const uint8_t* args, size_t size);
 };
 
 #endif /* SRC_COMMANDS_COMMANDS_H */
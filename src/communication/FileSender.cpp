@@ -0,0 +1,304 @@
+#include "FileSender.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include "logger.h"
+#include "utils/Crc32.h"
+
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+
+// Kind + transfer id
+static const unsigned int CHUNK_PREFIX_SIZE = 5;
+
+static void writeUInt32(uint8_t* buf, uint32_t value)
+{
+    buf[0] = (uint8_t)value;
+    buf[1] = (uint8_t)(value >> 8);
+    buf[2] = (uint8_t)(value >> 16);
+    buf[3] = (uint8_t)(value >> 24);
+}
+
+/**
+ * Reads up to len bytes, retrying after partial reads.
+ * @return Number of bytes read, -1 on error
+ */
+static ssize_t readFully(int fd, uint8_t* buf, size_t len)
+{
+    size_t total = 0;
+    while (total < len)
+    {
+        ssize_t n = read(fd, buf + total, len - total);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+        total += n;
+    }
+    return total;
+}
+
+FileSender::FileSender(MessageEncoder& encoder, string folder)
+    : encoder(encoder), folder(folder)
+{
+    frame = new uint8_t[MSG_MAX_LENGTH];
+
+    thread_sender = unique_ptr<thread>(new thread(&FileSender::run, this));
+}
+
+FileSender::~FileSender()
+{
+    aborted = true;
+    queue.close();
+
+    if (thread_sender->joinable())
+    {
+        thread_sender->join();
+    }
+    delete[] frame;
+}
+
+bool FileSender::request(int client, const string& name, uint32_t offset,
+                         bool checksum)
+{
+    // Only files directly inside the folder can be requested
+    if (name.find('/') != string::npos || name == "." || name == "..")
+    {
+        Log.e("Invalid file name: %s", name.c_str());
+        return false;
+    }
+
+    if (!queue.offer({client, name, offset, checksum}))
+    {
+        Log.w("Too many file transfers queued, dropping %s", name.c_str());
+        return false;
+    }
+    return true;
+}
+
+void FileSender::run()
+{
+    FileRequest req;
+    while (queue.take(req))
+    {
+        aborted = false;
+        client  = req.client;
+
+        if (!send(req))
+        {
+            // Let the client discard the partial file
+            sendChunk(FILE_CHUNK_ABORT, 0);
+        }
+        transfer_id++;
+    }
+}
+
+bool FileSender::send(const FileRequest& req)
+{
+    string name = req.name.empty() ? latestFile() : req.name;
+    if (name.empty())
+    {
+        Log.w("No file to send.");
+        return false;
+    }
+
+    string path = folder + name;
+    auto file   = std::make_shared<FileHandle>(open(path.c_str(), O_RDONLY));
+    if (file->fd < 0)
+    {
+        Log.e("Cannot open %s, errno: %d", path.c_str(), errno);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(file->fd, &st) != 0 || st.st_size > UINT32_MAX)
+    {
+        Log.e("Cannot send %s", path.c_str());
+        return false;
+    }
+    uint32_t file_size = (uint32_t)st.st_size;
+
+    if (req.offset > file_size)
+    {
+        Log.e("Bad offset for %s: %u, size: %u", name.c_str(), req.offset,
+              file_size);
+        return false;
+    }
+
+    Log.i("Sending %s (%u bytes, from %u)", name.c_str(), file_size,
+          req.offset);
+    auto start = steady_clock::now();
+
+    uint8_t* args = frame + MSG_HEADER_SIZE + CHUNK_PREFIX_SIZE;
+
+    size_t name_len = std::min(name.size(), (size_t)FILE_CHUNK_SIZE);
+    writeUInt32(args, file_size);
+    writeUInt32(args + 4, req.offset);
+    args[8] = req.checksum ? FILE_FLAG_CHECKSUM : 0;
+    memcpy(args + 9, name.c_str(), name_len);
+
+    if (!sendChunk(FILE_CHUNK_BEGIN, 9 + name_len))
+    {
+        return false;
+    }
+
+    uint32_t crc = 0;
+    bool success = req.checksum
+                       ? sendChecked(file, file_size, req.offset, crc)
+                       : sendZeroCopy(file, file_size, req.offset);
+    if (!success)
+    {
+        return false;
+    }
+
+    writeUInt32(args, file_size);
+    writeUInt32(args + 4, crc);
+    if (!sendChunk(FILE_CHUNK_END, 8))
+    {
+        return false;
+    }
+
+    int ms = (int)duration_cast<milliseconds>(steady_clock::now() - start)
+                 .count();
+    Log.i("Sent %s in %d ms", name.c_str(), ms);
+    return true;
+}
+
+bool FileSender::sendChecked(shared_ptr<FileHandle> file, uint32_t file_size,
+                             uint32_t offset, uint32_t& crc)
+{
+    uint8_t* args = frame + MSG_HEADER_SIZE + CHUNK_PREFIX_SIZE;
+    uint8_t* data = frame + MSG_HEADER_SIZE + FILE_CHUNK_HEADER_SIZE;
+
+    // The checksum of the whole file also covers the part already received
+    uint32_t pos = 0;
+    crc          = 0;
+
+    while (pos < file_size)
+    {
+        bool skipped = pos < offset;
+        size_t len   = skipped ? std::min(FILE_CHUNK_SIZE, offset - pos)
+                             : FILE_CHUNK_SIZE;
+
+        ssize_t n = readFully(file->fd, data, len);
+        if (n <= 0)
+        {
+            Log.e("Error reading file, errno: %d", errno);
+            return false;
+        }
+
+        uint32_t chunk_crc = Crc32::update(0, data, n);
+        crc = Crc32::update(crc, data, n);
+
+        if (!skipped)
+        {
+            writeUInt32(args, pos);
+            writeUInt32(args + 4, chunk_crc);
+
+            if (aborted)
+            {
+                Log.i("File transfer aborted.");
+                return false;
+            }
+            if (!sendChunk(FILE_CHUNK_DATA, 8 + n))
+            {
+                return false;
+            }
+        }
+        pos += n;
+    }
+    return true;
+}
+
+bool FileSender::sendZeroCopy(shared_ptr<FileHandle> file, uint32_t file_size,
+                              uint32_t offset)
+{
+    uint8_t* prefix = frame + MSG_HEADER_SIZE;
+    uint8_t* args   = prefix + CHUNK_PREFIX_SIZE;
+
+    prefix[0] = FILE_CHUNK_DATA;
+    writeUInt32(prefix + 1, transfer_id);
+    writeUInt32(args + 4, 0);  // No checksum
+
+    for (uint32_t pos = offset; pos < file_size; pos += FILE_CHUNK_SIZE)
+    {
+        if (aborted)
+        {
+            Log.i("File transfer aborted.");
+            return false;
+        }
+
+        uint16_t len = (uint16_t)std::min(FILE_CHUNK_SIZE, file_size - pos);
+        writeUInt32(args, pos);
+
+        if (!encoder.sendFile(client, frame, FILE_CHUNK_HEADER_SIZE, file, pos,
+                              len, FILE_SEND_TIMEOUT))
+        {
+            Log.e("Cannot send file chunk: client gone or too slow.");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FileSender::sendChunk(FileChunkKind kind, uint16_t payload_len)
+{
+    uint8_t* prefix = frame + MSG_HEADER_SIZE;
+    prefix[0]       = kind;
+    writeUInt32(prefix + 1, transfer_id);
+
+    if (!encoder.sendFile(client, frame, CHUNK_PREFIX_SIZE + payload_len,
+                          FILE_SEND_TIMEOUT))
+    {
+        Log.e("Cannot send file chunk: client gone or too slow.");
+        return false;
+    }
+    return true;
+}
+
+string FileSender::latestFile()
+{
+    DIR* dir = opendir(folder.c_str());
+    if (dir == nullptr)
+    {
+        return "";
+    }
+
+    string latest;
+    time_t latest_time = 0;
+
+    dirent* entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        // Skip hidden files, such as captures still being downloaded
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+
+        struct stat st;
+        string path = folder + entry->d_name;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_mtime >= latest_time)
+        {
+            latest      = entry->d_name;
+            latest_time = st.st_mtime;
+        }
+    }
+    closedir(dir);
+
+    return latest;
+}
@@ -0,0 +1,146 @@
+#ifndef SRC_COMMUNICATION_FILESENDER_H
+#define SRC_COMMUNICATION_FILESENDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "Message.h"
+#include "MessageEncoder.h"
+#include "utils/BoundedQueue.h"
+#include "utils/FileHandle.h"
+
+using std::atomic_bool;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::chrono::milliseconds;
+
+/*
+ * File transfer messages (MSGTYPE_FILE), little endian:
+ *
+ *     1         4
+ * |KIND|TRANSFER_ID|   ...   |
+ *
+ * FILE_CHUNK_BEGIN: |FILE_SIZE (4)|OFFSET (4)|FLAGS (1)|NAME...|
+ * FILE_CHUNK_DATA:  |OFFSET (4)|CRC32 (4)|DATA...|
+ * FILE_CHUNK_END:   |FILE_SIZE (4)|CRC32 (4)|
+ * FILE_CHUNK_ABORT: no arguments
+ *
+ * The CRC32 in the data chunks covers the chunk data only, the one in the
+ * end chunk covers the whole file, including the part skipped when resuming
+ * from an offset.
+ * Checksums are only computed if FILE_FLAG_CHECKSUM is set, and are 0
+ * otherwise: the file is then sent with sendfile() without being read by the
+ * process.
+ */
+
+enum FileChunkKind : uint8_t
+{
+    FILE_CHUNK_BEGIN = 0,
+    FILE_CHUNK_DATA  = 1,
+    FILE_CHUNK_END   = 2,
+    FILE_CHUNK_ABORT = 3
+};
+
+enum FileFlags : uint8_t
+{
+    FILE_FLAG_CHECKSUM = 0x01
+};
+
+static const unsigned int FILE_CHUNK_HEADER_SIZE = 13;  // Data chunks
+static const unsigned int FILE_CHUNK_SIZE        = 63 * 1024;
+
+static_assert(FILE_CHUNK_HEADER_SIZE + FILE_CHUNK_SIZE <= MSG_MAX_PAYLOAD_SIZE,
+              "File chunks must fit in a single message");
+
+// Max number of requested files waiting to be sent
+static const unsigned int FILE_QUEUE_SIZE = 8;
+
+// Max time to wait for a slow client before aborting a transfer
+static const milliseconds FILE_SEND_TIMEOUT{5000};
+
+/**
+ * Streams files from the download folder to the clients that requested them
+ * on a separate thread, one transfer at a time.
+ */
+class FileSender
+{
+public:
+    FileSender(MessageEncoder& encoder, string folder);
+    ~FileSender();
+
+    /**
+     * Queues a file to be sent. Never blocks.
+     * @param client Socket of the client to send the file to
+     * @param name Name of a file in the folder. Empty for the most recent one.
+     * @param offset Position to start sending from, to resume a transfer
+     * @param checksum Read the file to compute the checksums
+     * @return False if the name is not valid or too many files are queued
+     */
+    bool request(int client, const string& name, uint32_t offset = 0,
+                 bool checksum = false);
+
+    /**
+     * Stops the current transfer.
+     */
+    void abort() { aborted = true; }
+
+private:
+    struct FileRequest
+    {
+        int client;
+        string name;
+        uint32_t offset;
+        bool checksum;
+    };
+
+    void run();
+
+    bool send(const FileRequest& req);
+
+    /**
+     * Sends the data chunks of a file, reading it to compute the checksums.
+     * @return CRC32 of the whole file, in crc
+     */
+    bool sendChecked(shared_ptr<FileHandle> file, uint32_t file_size,
+                     uint32_t offset, uint32_t& crc);
+
+    /**
+     * Sends the data chunks of a file with sendfile().
+     */
+    bool sendZeroCopy(shared_ptr<FileHandle> file, uint32_t file_size,
+                      uint32_t offset);
+
+    /**
+     * @return Name of the most recently modified file in the folder, empty
+     * if there is none.
+     */
+    string latestFile();
+
+    /**
+     * Writes the header of a chunk and sends it.
+     * @param payload_len Size of the chunk arguments, after the header
+     */
+    bool sendChunk(FileChunkKind kind, uint16_t payload_len);
+
+    MessageEncoder& encoder;
+    const string folder;
+
+    BoundedQueue<FileRequest> queue{FILE_QUEUE_SIZE};
+
+    // Message header + chunk header + data
+    uint8_t* frame;
+
+    uint32_t transfer_id = 0;
+    int client           = -1;  // Receiver of the current transfer
+    atomic_bool aborted{false};
+
+    unique_ptr<thread> thread_sender;
+};
+
+#endif /* SRC_COMMUNICATION_FILESENDER_H */
@@ -17,15 +17,32 @@
 static const uint8_t MAGIC_WORD_1 = 0x54;
 static const uint8_t MAGIC_WORD_2 = 0xF0;
 
-static const unsigned int MSG_HEADER_SIZE = 5;
-static const unsigned int MSG_MAX_LENGTH  = 0xFFFF + MSG_HEADER_SIZE;
+static const unsigned int MSG_HEADER_SIZE      = 5;
+static const unsigned int MSG_MAX_PAYLOAD_SIZE = 0xFFFF;
+static const unsigned int MSG_MAX_LENGTH = MSG_MAX_PAYLOAD_SIZE + MSG_HEADER_SIZE;
 
 enum MessageType : uint8_t
 {
     MSGTYPE_LOG         = 1,
     MSGTYPE_TELECOMMAND = 2,
     MSGTYPE_TELEMETRY   = 3,
-    MSGTYPE_FILE        = 4
+    MSGTYPE_FILE        = 4,
+    MSGTYPE_BINARY_TELECOMMAND = 5
+};
+
+// Destination of messages sent to every connected client
+static const int ALL_CLIENTS = -1;
+
+/**
+ * Non-owning view of a received message. The data is only valid until the
+ * function the view was passed to returns.
+ */
+struct MessageView
+{
+    uint8_t type;
+    uint16_t size;
+    const uint8_t* data;
+    int client;  // Socket of the client that sent it
 };
 
 struct Message
@@ -11,37 +11,103 @@
 using std::max;
 using std::min;
 
-MessageDecoder::MessageDecoder(MessageHandler& msgHandler) : handler(msgHandler)
+MessageDecoder::MessageDecoder(int client, MessageHandler& msgHandler,
+                               MessagePool& pool)
+    : client(client), handler(msgHandler), pool(pool)
 {
 }
 
 MessageDecoder::~MessageDecoder()
 {
-    if (message != nullptr)
+    if (payload != nullptr)
     {
-        delete message;
+        pool.release(payload);
     }
 }
-void MessageDecoder::dispatch() { handler.handleMessage(*message); }
+
+void MessageDecoder::dispatch(const uint8_t* msg_data)
+{
+    MessageView msg{temp_type, msg_size, msg_data, client};
+    handler.handleMessage(msg);
+
+    if (payload != nullptr)
+    {
+        pool.release(payload);
+        payload = nullptr;
+    }
+}
+
+size_t MessageDecoder::onHeader(const uint8_t* data, size_t len)
+{
+    received_data = 0;
+    Log.d("Message received: type:%d, size:%d", temp_type, msg_size);
+
+    // Whole payload available: no need to copy it
+    if (len >= msg_size)
+    {
+        dispatch(data);
+        state = DecoderState::START;
+        return msg_size;
+    }
+
+    payload = pool.acquire();
+    if (payload == nullptr)
+    {
+        Log.e("No buffer available, discarding message.");
+        state = DecoderState::DISCARDING_DATA;
+    }
+    else
+    {
+        state = DecoderState::RECEIVING_DATA;
+    }
+    return 0;
+}
 
 void MessageDecoder::decode(uint8_t* data, size_t len)
 {
+    // i must always point to the last consumed byte
     for (size_t i = 0; i < len; i++)
     {
         switch (state)
         {
             case DecoderState::START:
-                if (data[i] == MAGIC_WORD_1)
+            {
+                // Skip everything up to the next possible message
+                uint8_t* magic =
+                    (uint8_t*)memchr(data + i, MAGIC_WORD_1, len - i);
+                if (magic == nullptr)
                 {
+                    i = len - 1;
+                    break;
+                }
+                i = magic - data;
+
+                if (len - i < MSG_HEADER_SIZE)
+                {
+                    // Header split between reads: go byte by byte
                     state = DecoderState::MAGIC1_FOUND;
+                    break;
+                }
+
+                if (data[i + 1] != MAGIC_WORD_2)
+                {
+                    break;
                 }
+
+                // Parse the whole header at once
+                temp_type = data[i + 2];
+                msg_size  = data[i + 4] << 8 | (uint16_t)data[i + 3];
+                i += MSG_HEADER_SIZE - 1;
+
+                i += onHeader(data + i + 1, len - i - 1);
                 break;
+            }
             case DecoderState::MAGIC1_FOUND:
                 if (data[i] == MAGIC_WORD_2)
                 {
                     state = DecoderState::MAGIC2_FOUND;
                 }
-                else
+                else if (data[i] != MAGIC_WORD_1)
                 {
                     state = DecoderState::START;
                 }
@@ -58,29 +124,32 @@ void MessageDecoder::decode(uint8_t* data, size_t len)
             }
             case DecoderState::SIZE1_RECEIVED:
             {
-                uint16_t size = data[i] << 8 | (uint16_t)temp_size1;
-                state         = DecoderState::RECEIVING_DATA;
-                if (message != nullptr)
-                {
-                    delete message;
-                }
-                message       = new Message(temp_type, size);
-                received_data = 0;
-                state         = DecoderState::RECEIVING_DATA;
-                Log.d("Message created: type:%d, size:%d", temp_type, size);
+                msg_size = data[i] << 8 | (uint16_t)temp_size1;
+
+                i += onHeader(data + i + 1, len - i - 1);
                 break;
             }
             case DecoderState::RECEIVING_DATA:
             {
-                size_t sz = min(len - i, (size_t)message->size - received_data);
-                memcpy(message->data + received_data, data + i, sz);
+                size_t sz = min(len - i, (size_t)msg_size - received_data);
+                memcpy(payload + received_data, data + i, sz);
                 received_data += sz;
-                i += sz - 1;  // i must point to the last copied byte
-                Log.d("Receive data: received: %d, sz: %d", received_data, sz);
-                if (received_data == message->size)
+                i += sz - 1;
+                if (received_data == msg_size)
                 {
                     Log.d("Dispatch.");
-                    dispatch();
+                    dispatch(payload);
+                    state = DecoderState::START;
+                }
+                break;
+            }
+            case DecoderState::DISCARDING_DATA:
+            {
+                size_t sz = min(len - i, (size_t)msg_size - received_data);
+                received_data += sz;
+                i += sz - 1;
+                if (received_data == msg_size)
+                {
                     state = DecoderState::START;
                 }
                 break;
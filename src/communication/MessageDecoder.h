@@ -11,14 +11,26 @@
 
 #include "Message.h"
 #include "MessageHandler.h"
-#include "circular_buffer.h"
+#include "MessagePool.h"
 
+/**
+ * Extracts messages from a stream of bytes. Messages entirely contained in
+ * the decoded data are passed to the handler as a view of that data.
+ * Otherwise the payload is collected in a buffer taken from the pool: no
+ * memory is allocated while decoding.
+ */
 class MessageDecoder
 {
 public:
-    MessageDecoder(MessageHandler& msgHandler);
+    /**
+     * @param client Socket the data is received from
+     */
+    MessageDecoder(int client, MessageHandler& msgHandler, MessagePool& pool);
     ~MessageDecoder();
 
+    MessageDecoder(const MessageDecoder&) = delete;
+    MessageDecoder& operator=(const MessageDecoder&) = delete;
+
     void decode(uint8_t* data, size_t len);
 
 private:
@@ -29,19 +41,30 @@ private:
         MAGIC2_FOUND,
         TYPE_RECEIVED,
         SIZE1_RECEIVED,
-        RECEIVING_DATA
+        RECEIVING_DATA,
+        DISCARDING_DATA  // No buffer available for the payload
     };
 
-    void dispatch();
+    /**
+     * Called when the header of a message has been decoded.
+     * @param data Data received after the header
+     * @return Number of bytes of data consumed
+     */
+    size_t onHeader(const uint8_t* data, size_t len);
+
+    void dispatch(const uint8_t* msg_data);
 
     DecoderState state   = DecoderState::START;
     uint8_t temp_type    = 0;
     uint8_t temp_size1   = 0;
+    uint16_t msg_size    = 0;
     size_t received_data = 0;
 
-    Message* message = nullptr;
+    uint8_t* payload = nullptr;  // Taken from the pool while receiving data
 
+    const int client;
     MessageHandler& handler;
+    MessagePool& pool;
 };
 
 #endif /* SRC_COMMUNICATION_MESSAGEDECODER_H */
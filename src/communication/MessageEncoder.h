@@ -9,8 +9,12 @@
 #include <algorithm>
 #include <cstdio>
 #include <cstring>
+#include <mutex>
 #include "TCPServer.h"
 
+using std::lock_guard;
+using std::mutex;
+
 class MessageEncoder
 {
 public:
@@ -21,15 +25,82 @@ public:
     ~MessageEncoder() { delete[] buf; }
 
     bool sendLog(const char* str, size_t len)
+    {
+        return send(MSGTYPE_LOG, (const uint8_t*)str, len);
+    }
+
+    /**
+     * @param client Socket of the client to send it to, or ALL_CLIENTS
+     */
+    bool sendTelemetry(const char* str, size_t len, int client = ALL_CLIENTS)
+    {
+        return send(MSGTYPE_TELEMETRY, (const uint8_t*)str, len, client);
+    }
+
+    /**
+     * Sends a single MSGTYPE_FILE message without copying the payload in the
+     * encoder buffer, waiting for space in the send queues instead of
+     * dropping it.
+     * @param frame Buffer of MSG_HEADER_SIZE + payload_len bytes: the header is
+     * written in the first MSG_HEADER_SIZE bytes, followed by the payload
+     * @param client Socket of the client to send it to
+     * @return False if the message could not be queued before the timeout
+     */
+    bool sendFile(int client, uint8_t* frame, uint16_t payload_len,
+                  milliseconds timeout)
+    {
+        frame[0] = MAGIC_WORD_1;
+        frame[1] = MAGIC_WORD_2;
+        frame[2] = MSGTYPE_FILE;
+        frame[3] = (uint8_t)payload_len;
+        frame[4] = (uint8_t)(payload_len >> 8);
+
+        return server->sendData(client, frame, payload_len + MSG_HEADER_SIZE,
+                                timeout);
+    }
+
+    /**
+     * Sends a single MSGTYPE_FILE message whose payload ends with data read
+     * directly from a file by the kernel, without copying it.
+     * @param frame Buffer of MSG_HEADER_SIZE + header_len bytes, as above
+     * @param header_len Size of the part of the payload before the file data
+     */
+    bool sendFile(int client, uint8_t* frame, uint16_t header_len,
+                  shared_ptr<FileHandle> file, off_t offset, uint16_t data_len,
+                  milliseconds timeout)
+    {
+        uint16_t payload_len = header_len + data_len;
+
+        frame[0] = MAGIC_WORD_1;
+        frame[1] = MAGIC_WORD_2;
+        frame[2] = MSGTYPE_FILE;
+        frame[3] = (uint8_t)payload_len;
+        frame[4] = (uint8_t)(payload_len >> 8);
+
+        return server->sendFileData(client, frame, header_len + MSG_HEADER_SIZE,
+                                    file, offset, data_len, timeout);
+    }
+
+private:
+    /**
+     * Sends data as one or more messages of the provided type, splitting it
+     * if it does not fit in a single message.
+     * @param client Socket of the client to send it to, or ALL_CLIENTS
+     * @return False if any of the messages was not queued for any client
+     */
+    bool send(uint8_t type, const uint8_t* data, size_t len,
+              int client = ALL_CLIENTS)
     {
         uint16_t maxlen = 0xFFFF;
-        uint8_t type    = MSGTYPE_LOG;
+
+        lock_guard<mutex> l(mtx_buf);
 
         buf[0] = MAGIC_WORD_1;
         buf[1] = MAGIC_WORD_2;
         buf[2] = type;
 
         size_t consumed = 0;
+        bool sent       = true;
 
         while (consumed < len)
         {
@@ -46,21 +117,26 @@ public:
             buf[3] = (uint8_t)size;
             buf[4] = (uint8_t)(size >> 8);
 
-            memcpy(buf + MSG_HEADER_SIZE, str + consumed, size);
+            memcpy(buf + MSG_HEADER_SIZE, data + consumed, size);
             consumed += size;
 
-            server->sendData(buf, size + MSG_HEADER_SIZE);
+            if (client == ALL_CLIENTS)
+            {
+                sent &= server->sendData(buf, size + MSG_HEADER_SIZE);
+            }
+            else
+            {
+                sent &= server->sendData(client, buf, size + MSG_HEADER_SIZE);
+            }
         }
-        return true;
+        return sent;
     }
 
-    void sendTelemetry() {}
-
-    void sendFile() {}
-
-private:
     uint8_t* buf;
     TCPServer* server;
+
+    // Logs and telemetry may be sent from different threads
+    mutex mtx_buf;
 };
 
 #endif /* SRC_COMMUNICATION_MESSAGEENCODER_H */
@@ -10,48 +10,51 @@
 #include <vector>
 
 #include "Message.h"
-#include "commands/Commands.h"
+#include "commands/CommandDispatcher.h"
 #include "logger.h"
 
 using std::string;
 using std::vector;
 
-class OnMessageReceivedListener
-{
-public:
-    virtual void onCommandReceived(const Command& command) = 0;
-
-    virtual ~OnMessageReceivedListener() {}
-};
-
 class MessageHandler
 {
 public:
-    MessageHandler(OnMessageReceivedListener& listener) : listener(listener) {}
+    MessageHandler(CommandExecutor& executor) : executor(executor) {}
 
-    void handleMessage(const Message& msg)
+    void handleMessage(const MessageView& msg)
     {
         switch (msg.type)
         {
             case MessageType::MSGTYPE_TELECOMMAND:
             {
-                string s =
-                    string(reinterpret_cast<const char*>(msg.data), msg.size);
-
-                json j = json::parse(s);
-                Command* c;
-                if (JsonCommandDecoder::decode(&c, j))
+                json j;
+                try
+                {
+                    // Parse directly from the message buffer
+                    j = json::parse(msg.data, msg.data + msg.size);
+                }
+                catch (json::parse_error& e)
                 {
-                    listener.onCommandReceived(*c);
-                    delete c;
+                    Log.e(e.what());
+                    break;
                 }
-                else
+
+                if (!CommandDispatcher::dispatchJson(j, msg.client, executor))
                 {
                     Log.e("Couldn't decode telecommand.");
                 }
 
                 break;
             }
+            case MessageType::MSGTYPE_BINARY_TELECOMMAND:
+            {
+                if (!CommandDispatcher::dispatchBinary(msg.data, msg.size,
+                                                       msg.client, executor))
+                {
+                    Log.e("Couldn't decode binary telecommand.");
+                }
+                break;
+            }
             default:
             {
                 Log.e("Unknown message received.");
@@ -63,7 +66,7 @@ public:
     }
 
 private:
-    OnMessageReceivedListener& listener;
+    CommandExecutor& executor;
 };
 
 #endif /* SRC_COMMUNICATION_MESSAGEHANDLER_H */
@@ -0,0 +1,70 @@
+#ifndef SRC_COMMUNICATION_MESSAGEPOOL_H
+#define SRC_COMMUNICATION_MESSAGEPOOL_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "Message.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::vector;
+
+// Each buffer can hold the payload of the biggest possible message
+static const unsigned int MSG_POOL_BUF_SIZE = 64 * 1024;  // 64 KiB
+
+/**
+ * Fixed set of payload buffers, all allocated upfront, shared by the message
+ * decoders so that receiving a message never allocates memory.
+ */
+class MessagePool
+{
+public:
+    MessagePool(size_t num_buffers) : num_buffers(num_buffers)
+    {
+        memory = new uint8_t[num_buffers * MSG_POOL_BUF_SIZE];
+
+        free_buffers.reserve(num_buffers);
+        for (size_t i = 0; i < num_buffers; i++)
+        {
+            free_buffers.push_back(memory + i * MSG_POOL_BUF_SIZE);
+        }
+    }
+
+    ~MessagePool() { delete[] memory; }
+
+    MessagePool(const MessagePool&) = delete;
+    MessagePool& operator=(const MessagePool&) = delete;
+
+    /**
+     * @return A buffer of MSG_POOL_BUF_SIZE bytes, or nullptr if they are all
+     * in use
+     */
+    uint8_t* acquire()
+    {
+        lock_guard<mutex> l(mtx);
+        if (free_buffers.empty())
+        {
+            return nullptr;
+        }
+        uint8_t* buf = free_buffers.back();
+        free_buffers.pop_back();
+        return buf;
+    }
+
+    void release(uint8_t* buf)
+    {
+        lock_guard<mutex> l(mtx);
+        free_buffers.push_back(buf);
+    }
+
+private:
+    const size_t num_buffers;
+    uint8_t* memory;
+
+    mutex mtx;
+    vector<uint8_t*> free_buffers;  // Never grows past num_buffers
+};
+
+#endif /* SRC_COMMUNICATION_MESSAGEPOOL_H */
@@ -5,17 +5,28 @@
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
 
 #include <unistd.h>
+#include <algorithm>
 #include <cerrno>
+#include <csignal>
 
 #include "TCPServer.h"
 #include "logger.h"
 
+using std::lock_guard;
 using std::unique_lock;
 
-TCPServer::TCPServer(MessageDecoder &decoder, int port)
-    : port(port), decoder(decoder)
+static const int MAX_EPOLL_EVENTS = 16;
+
+static const char *MSGTYPE_NAMES[] = {"unknown",   "log",  "telecommand",
+                                      "telemetry", "file", "binary_telecommand"};
+
+TCPServer::TCPServer(MessageHandler &handler, int port)
+    : port(port), handler(handler)
 {
     recv_buf = new uint8_t[RECV_BUF_SIZE];
     memset(recv_buf, 0, RECV_BUF_SIZE);
@@ -26,9 +37,9 @@ TCPServer::~TCPServer() { delete[] recv_buf; }
 bool TCPServer::start()
 {
     int result;
-    sockaddr_in addr_serv{0};
+    sockaddr_in addr_serv{};
 
-    sck_server = socket(AF_INET, SOCK_STREAM, 0);
+    sck_server = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
 
     if (sck_server < 0)
     {
@@ -40,6 +51,9 @@ bool TCPServer::start()
     addr_serv.sin_addr.s_addr = INADDR_ANY;
     addr_serv.sin_port        = htons(port);
 
+    // sendfile() has no MSG_NOSIGNAL: handle closed sockets through errno
+    signal(SIGPIPE, SIG_IGN);
+
     int yes = 1;
     result =
         setsockopt(sck_server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
@@ -57,90 +71,570 @@ bool TCPServer::start()
         return false;
     }
 
-    result = listen(sck_server, 1);
+    result = listen(sck_server, MAX_CLIENTS);
     if (result != 0)
     {
         Log.e("Error listening: %d", result);
         return false;
     }
 
-    // Run the receiver thread
-    thread_recv = unique_ptr<thread>(new thread(&TCPServer::fn_server, this));
-    thread_send = unique_ptr<thread>(new thread(&TCPServer::fn_sender, this));
+    fd_epoll  = epoll_create1(0);
+    fd_wakeup = eventfd(0, EFD_NONBLOCK);
+    if (fd_epoll < 0 || fd_wakeup < 0)
+    {
+        Log.e("Error creating epoll instance, errno: %d", errno);
+        return false;
+    }
+
+    epoll_event ev{};
+    ev.events  = EPOLLIN;
+    ev.data.fd = sck_server;
+    epoll_ctl(fd_epoll, EPOLL_CTL_ADD, sck_server, &ev);
 
-    thread_recv.get()->detach();
-    thread_send.get()->detach();
+    ev.data.fd = fd_wakeup;
+    epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_wakeup, &ev);
+
+    // Run the event loop
+    thread_reactor =
+        unique_ptr<thread>(new thread(&TCPServer::fn_reactor, this));
+    thread_reactor.get()->detach();
 
     return true;
 }
 
-void TCPServer::sendData(const uint8_t *data, size_t size)
+bool TCPServer::sendData(const uint8_t *data, size_t size)
+{
+    bool wakeup = false;
+    bool queued = false;
+    {
+        lock_guard<mutex> l(mtx_clients);
+        for (auto it = clients.begin(); it != clients.end(); it++)
+        {
+            queued |= queueMessage(*it->second, data, size, wakeup);
+        }
+    }
+
+    if (wakeup)
+    {
+        wakeReactor();
+    }
+    return queued;
+}
+
+bool TCPServer::sendData(int sck, const uint8_t *data, size_t size)
 {
+    bool wakeup = false;
+    bool queued = false;
     {
-        unique_lock<mutex> l(mtx_sender);
-        send_buf.put(data, size);
+        lock_guard<mutex> l(mtx_clients);
+        auto it = clients.find(sck);
+        if (it != clients.end())
+        {
+            queued = queueMessage(*it->second, data, size, wakeup);
+        }
     }
-    cv_sender.notify_one();
+
+    if (wakeup)
+    {
+        wakeReactor();
+    }
+    return queued;
 }
 
-void TCPServer::fn_server()
+bool TCPServer::queueMessage(Client &client, const uint8_t *data, size_t size,
+                             bool &wakeup)
 {
-    int result       = 0;
-    socklen_t clilen = 0;
-    sockaddr_in addr_client{0};
+    assert(size >= MSG_HEADER_SIZE);
+    uint8_t type = data[2] < NUM_MSG_TYPES ? data[2] : 0;
 
-    while (true)
+    // Logs are the first to be dropped when a client cannot keep up
+    size_t required = size;
+    if (type == MSGTYPE_LOG)
+    {
+        required += LOG_RESERVED_SPACE;
+    }
+
+    // Never queue part of a message
+    if (client.send_buf.freeSpace() < required)
+    {
+        dropped[type].frames++;
+        dropped[type].bytes += size;
+        return false;
+    }
+    wakeup |= queue(client, data, size);
+    return true;
+}
+
+bool TCPServer::sendData(int sck, const uint8_t *data, size_t size,
+                         milliseconds timeout)
+{
+    bool wakeup = false;
+    {
+        unique_lock<mutex> l(mtx_clients);
+
+        // Only the queue of the receiving client is waited on, stop as soon
+        // as it disconnects
+        bool ready = cv_space.wait_for(l, timeout, [&]() {
+            auto it = clients.find(sck);
+            return it == clients.end() ||
+                   it->second->send_buf.freeSpace() >= size;
+        });
+
+        auto it = clients.find(sck);
+        if (!ready || it == clients.end())
+        {
+            return false;
+        }
+        wakeup = queue(*it->second, data, size);
+    }
+
+    if (wakeup)
+    {
+        wakeReactor();
+    }
+    return true;
+}
+
+bool TCPServer::sendFileData(int sck, const uint8_t *header,
+                             size_t header_size, shared_ptr<FileHandle> file,
+                             off_t offset, size_t size, milliseconds timeout)
+{
+    assert(header_size <= FILE_SEGMENT_HEADER_SIZE);
+
+    FileSegment segment;
+    memcpy(segment.header, header, header_size);
+    segment.header_size = header_size;
+    segment.file        = file;
+    segment.offset      = offset;
+    segment.size        = size;
+
+    bool wakeup = false;
+    {
+        unique_lock<mutex> l(mtx_clients);
+
+        // Other clients, even slow or disconnecting ones, never delay the
+        // transfer
+        bool ready = cv_space.wait_for(l, timeout, [&]() {
+            auto it = clients.find(sck);
+            return it == clients.end() ||
+                   it->second->segments.size() < FILE_SEGMENT_QUEUE_SIZE;
+        });
+
+        auto it = clients.find(sck);
+        if (!ready || it == clients.end())
+        {
+            return false;
+        }
+
+        Client &client = *it->second;
+
+        segment.after = client.queued;
+        client.segments.push_back(segment);
+
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wakeup = client.idle.exchange(false);
+    }
+
+    if (wakeup)
+    {
+        wakeReactor();
+    }
+    return true;
+}
+
+void TCPServer::statsToJson(json &j)
+{
+    lock_guard<mutex> l(mtx_clients);
+
+    j["clients"] = clients.size();
+
+    json &queued = j["queued"];
+    queued       = json::array();
+    for (auto it = clients.begin(); it != clients.end(); it++)
     {
-        Log.i("Waiting for client...");
-        sck_client = accept(sck_server, (sockaddr *)&addr_client, &clilen);
+        queued.push_back(it->second->send_buf.currentSize());
+    }
 
-        if (sck_client < 0)
+    json &d = j["dropped"];
+    d       = json::object();
+    for (unsigned int i = 0; i < NUM_MSG_TYPES; i++)
+    {
+        if (dropped[i].frames == 0)
         {
-            Log.e("Error accepting client connection: %d", result);
             continue;
         }
-        Log.i("Client connected.");
 
-        client_connected = true;
-        cv_sender.notify_one();
+        const char *name = i < sizeof(MSGTYPE_NAMES) / sizeof(MSGTYPE_NAMES[0])
+                               ? MSGTYPE_NAMES[i]
+                               : MSGTYPE_NAMES[0];
+        d[name]["frames"] = dropped[i].frames;
+        d[name]["bytes"]  = dropped[i].bytes;
+    }
+}
 
-        while (receive())
-            ;
+bool TCPServer::queue(Client &client, const uint8_t *data, size_t size)
+{
+    client.send_buf.put(data, size);
+    client.queued += size;
+
+    // Only wake the reactor if it is not already sending
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return client.idle.exchange(false);
+}
 
-        Log.i("Client disconnected");
-        client_connected = false;
-        cv_sender.notify_one();
+void TCPServer::wakeReactor()
+{
+    uint64_t one = 1;
+    if (write(fd_wakeup, &one, sizeof(one)) < 0)
+    {
+        // Counter overflow: the reactor has already been signaled
+    }
+}
+
+void TCPServer::fn_reactor()
+{
+    epoll_event events[MAX_EPOLL_EVENTS];
+
+    Log.i("Waiting for clients...");
+
+    while (true)
+    {
+        int n = epoll_wait(fd_epoll, events, MAX_EPOLL_EVENTS, -1);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            Log.e("epoll_wait failed, errno: %d", errno);
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+
+            if (fd == sck_server)
+            {
+                acceptClients();
+            }
+            else if (fd == fd_wakeup)
+            {
+                uint64_t count;
+                if (read(fd_wakeup, &count, sizeof(count)) < 0)
+                {
+                    // Spurious wakeup
+                }
+
+                // Try to send the new data to every client right away
+                vector<int> closed;
+                for (auto it = clients.begin(); it != clients.end(); it++)
+                {
+                    if (!flush(*it->second))
+                    {
+                        closed.push_back(it->first);
+                    }
+                }
+                for (int sck : closed)
+                {
+                    closeClient(sck);
+                }
+            }
+            else
+            {
+                auto it = clients.find(fd);
+                if (it == clients.end())
+                {
+                    continue;
+                }
+                Client &client = *it->second;
+
+                bool alive = true;
+                if (events[i].events & (EPOLLERR | EPOLLHUP))
+                {
+                    alive = false;
+                }
+                if (alive && (events[i].events & EPOLLIN))
+                {
+                    alive = receive(client);
+                }
+                if (alive && (events[i].events & EPOLLOUT))
+                {
+                    alive = flush(client);
+                }
+
+                if (!alive)
+                {
+                    closeClient(fd);
+                }
+            }
+        }
     }
 
     Log.e("Server thread terminated. (sck: %d)", sck_server);
 }
 
-void TCPServer::fn_sender()
+void TCPServer::acceptClients()
 {
     while (true)
     {
-        const size_t buf_size = 512;
-        uint8_t buf[buf_size];
-        size_t len;
+        sockaddr_in addr_client{};
+        socklen_t clilen = sizeof(addr_client);
 
+        int sck = accept4(sck_server, (sockaddr *)&addr_client, &clilen,
+                          SOCK_NONBLOCK);
+
+        if (sck < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                Log.e("Error accepting client connection, errno: %d", errno);
+            }
+            return;
+        }
+
+        if (clients.size() >= MAX_CLIENTS)
+        {
+            Log.w("Too many clients, connection refused.");
+            close(sck);
+            continue;
+        }
+
+        epoll_event ev{};
+        ev.events  = EPOLLIN;
+        ev.data.fd = sck;
+        if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, sck, &ev) != 0)
+        {
+            Log.e("Error adding client to epoll, errno: %d", errno);
+            close(sck);
+            continue;
+        }
+
+        size_t num_clients;
+        {
+            lock_guard<mutex> l(mtx_clients);
+            clients[sck] = unique_ptr<Client>(new Client(sck, handler, msg_pool));
+            num_clients  = clients.size();
+        }
+
+        char addr_str[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr_client.sin_addr, addr_str, sizeof(addr_str));
+        Log.i("Client connected: %s (%d connected)", addr_str,
+              (int)num_clients);
+    }
+}
+
+void TCPServer::closeClient(int sck)
+{
+    epoll_ctl(fd_epoll, EPOLL_CTL_DEL, sck, nullptr);
+    close(sck);
+
+    size_t num_clients;
+    {
+        lock_guard<mutex> l(mtx_clients);
+        clients.erase(sck);
+        num_clients = clients.size();
+    }
+    notifySpace();
+
+    Log.i("Client disconnected (%d connected)", (int)num_clients);
+}
+
+void TCPServer::notifySpace()
+{
+    // Taking the lock makes sure that a producer is either already waiting
+    // or has not checked the free space yet
+    {
+        lock_guard<mutex> l(mtx_clients);
+    }
+    cv_space.notify_all();
+}
+
+bool TCPServer::receive(Client &client)
+{
+    while (true)
+    {
+        int n = read(client.sck, recv_buf, RECV_BUF_SIZE);
+        if (n > 0)
+        {
+            client.decoder.decode(recv_buf, n);
+        }
+        else if (n == 0)
+        {
+            return false;
+        }
+        else
+        {
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        }
+    }
+}
+
+bool TCPServer::flush(Client &client)
+{
+    client.idle = false;
+
+    // Notify the waiting producers once after freeing space in the queue
+    bool freed = false;
+
+    while (true)
+    {
+        ssize_t n;
+        if (client.segment != nullptr)
+        {
+            n = sendSegment(client);
+            if (n > 0 && client.segment_pos == client.segment->header_size +
+                                                   client.segment->size)
+            {
+                client.segment.reset();
+                freed = true;
+            }
+        }
+        else
         {
-            unique_lock<mutex> l(mtx_sender);
-            while (!client_connected || send_buf.currentSize() == 0)
+            size_t limit = client.send_buf.totalSize();
+            if (takeSegment(client, limit))
+            {
+                continue;
+            }
+
+            if (client.send_buf.currentSize() == 0)
+            {
+                // Check again after going idle, in case a producer queued
+                // data after the last check without waking us up
+                client.idle = true;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (client.send_buf.currentSize() > 0 || hasSegments(client))
+                {
+                    client.idle = false;
+                    continue;
+                }
+
+                // Everything has been sent
+                watchWritable(client, false);
+                if (freed)
+                {
+                    notifySpace();
+                }
+                return true;
+            }
+
+            n = sendQueued(client, limit);
+            freed |= n > 0;
+        }
+
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                // Socket buffer full: resume when it becomes writable
+                watchWritable(client, true);
+                if (freed)
+                {
+                    notifySpace();
+                }
+                return true;
+            }
+            if (errno == EINTR)
             {
-                cv_sender.wait(l);
+                continue;
             }
-            len = send_buf.get(buf, buf_size);
+            return false;
         }
-        send(sck_client.load(), buf, len, 0);
     }
 }
 
-bool TCPServer::receive()
+ssize_t TCPServer::sendQueued(Client &client, size_t limit)
 {
-    int n = read(sck_client, recv_buf, RECV_BUF_SIZE);
+    // Send both the regions of the ring buffer at once, without copying them
+    iovec iov[2];
+    msghdr msg{};
+    msg.msg_iov    = iov;
+    msg.msg_iovlen = client.send_buf.peek(iov, limit);
+
+    ssize_t n = sendmsg(client.sck, &msg, MSG_NOSIGNAL);
     if (n > 0)
     {
-        decoder.decode(recv_buf, n);
+        client.send_buf.consume(n);
+        client.dequeued += n;
     }
-    return n > 0;
+    return n;
+}
+
+bool TCPServer::takeSegment(Client &client, size_t &limit)
+{
+    lock_guard<mutex> l(mtx_clients);
+    if (client.segments.empty())
+    {
+        return false;
+    }
+
+    FileSegment &next = client.segments.front();
+    if (next.after > client.dequeued)
+    {
+        limit = (size_t)std::min((uint64_t)limit,
+                                 next.after - client.dequeued);
+        return false;
+    }
+
+    client.segment     = unique_ptr<FileSegment>(new FileSegment(next));
+    client.segment_pos = 0;
+    client.segments.pop_front();
+    return true;
+}
+
+bool TCPServer::hasSegments(Client &client)
+{
+    lock_guard<mutex> l(mtx_clients);
+    return !client.segments.empty();
+}
+
+ssize_t TCPServer::sendSegment(Client &client)
+{
+    FileSegment &segment = *client.segment;
+    ssize_t n;
+
+    if (client.segment_pos < segment.header_size)
+    {
+        // The body follows right away: let the kernel merge them
+        n = send(client.sck, segment.header + client.segment_pos,
+                 segment.header_size - client.segment_pos,
+                 MSG_NOSIGNAL | MSG_MORE);
+    }
+    else
+    {
+        size_t sent  = client.segment_pos - segment.header_size;
+        off_t offset = segment.offset + sent;
+        n = sendfile(client.sck, segment.file->fd, &offset,
+                     segment.size - sent);
+        if (n == 0)
+        {
+            // The file has been truncated: the message cannot be completed
+            Log.e("Unexpected end of file while sending a segment.");
+            errno = EIO;
+            return -1;
+        }
+    }
+
+    if (n > 0)
+    {
+        client.segment_pos += n;
+    }
+    return n;
+}
+
+void TCPServer::watchWritable(Client &client, bool enable)
+{
+    if (client.epollout == enable)
+    {
+        return;
+    }
+
+    epoll_event ev{};
+    ev.events  = enable ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.fd = client.sck;
+    epoll_ctl(fd_epoll, EPOLL_CTL_MOD, client.sck, &ev);
+
+    client.epollout = enable;
 }
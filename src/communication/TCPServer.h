@@ -13,6 +13,8 @@
 #include <chrono>
 #include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <ostream>
@@ -20,54 +22,241 @@
 #include <thread>
 
 #include "MessageDecoder.h"
-#include "circular_buffer.h"
+#include "MessageHandler.h"
+#include "MessagePool.h"
+#include "spsc_ring_buffer.h"
+#include "utils/FileHandle.h"
 
 using std::atomic_bool;
-using std::atomic_int;
 using std::condition_variable;
+using std::deque;
+using std::map;
 using std::mutex;
+using std::shared_ptr;
 using std::thread;
 
 using std::unique_ptr;
+using std::chrono::milliseconds;
 
-static const unsigned int SEND_BUF_SIZE = 1024 * 1024;  // 1 MiB
-static const unsigned int RECV_BUF_SIZE = 512;          // 512 Bytes
+static const unsigned int SEND_BUF_SIZE = 1024 * 1024;  // 1 MiB per client
+static const unsigned int RECV_BUF_SIZE = 64 * 1024;    // 64 KiB
 
+static const unsigned int MAX_CLIENTS = 8;
+
+// Space in each send queue that log messages cannot use, so that telemetry
+// still fits when a slow client makes the logs back up
+static const unsigned int LOG_RESERVED_SPACE = 256 * 1024;
+
+// Max size of the header sent before the body of a file segment
+static const unsigned int FILE_SEGMENT_HEADER_SIZE = 32;
+// Max number of file segments queued for each client
+static const unsigned int FILE_SEGMENT_QUEUE_SIZE = 16;
+
+/**
+ * Serves multiple clients at the same time from a single epoll based event
+ * loop. Incoming data from each client is decoded by its own MessageDecoder,
+ * while outgoing data is copied in the send queue of every connected client.
+ * File data is sent directly from the page cache instead.
+ */
 class TCPServer
 {
 public:
-    TCPServer(MessageDecoder &decoder, int port = 8888);
+    TCPServer(MessageHandler &handler, int port = 8888);
     ~TCPServer();
 
     bool start();
 
-    void sendData(const uint8_t *data, size_t size);
+    /**
+     * Queues a message to be sent to all the connected clients.
+     * Thread safe. The message is dropped for clients whose queue is full,
+     * log messages as soon as they would use the reserved space.
+     * @return False if the message was not queued for any client
+     */
+    bool sendData(const uint8_t *data, size_t size);
+
+    /**
+     * Queues a message to be sent to a single client, as above.
+     * @param sck Socket of the client
+     * @return False if the message was dropped or the client is gone
+     */
+    bool sendData(int sck, const uint8_t *data, size_t size);
+
+    /**
+     * Queues data to be sent to a single client, waiting up to timeout for
+     * its queue to have enough space. Used for data that cannot be dropped.
+     * Thread safe. Must not be called from the server thread.
+     * @param sck Socket of the client
+     * @return False if the client is gone or the timeout expired
+     */
+    bool sendData(int sck, const uint8_t *data, size_t size,
+                  milliseconds timeout);
+
+    /**
+     * Queues a message whose body is read straight from a file by the kernel
+     * with sendfile(), without copying it in the send queues. The header is
+     * sent right before the body.
+     * Waits up to timeout if the segment queue of the client is full.
+     * Thread safe. Must not be called from the server thread.
+     * @param sck Socket of the client
+     * @return False if the client is gone or the timeout expired
+     */
+    bool sendFileData(int sck, const uint8_t *header, size_t header_size,
+                      shared_ptr<FileHandle> file, off_t offset, size_t size,
+                      milliseconds timeout);
+
+    /**
+     * Writes the number of connected clients, the data queued for each one
+     * and the messages dropped so far.
+     */
+    void statsToJson(json &j);
 
 private:
+    // Message types are small: count drops for each one by value
+    static const unsigned int NUM_MSG_TYPES = 8;
+
+    struct DropCounter
+    {
+        uint64_t frames = 0;
+        uint64_t bytes  = 0;
+    };
+
+    struct FileSegment
+    {
+        uint8_t header[FILE_SEGMENT_HEADER_SIZE];
+        size_t header_size;
+
+        shared_ptr<FileHandle> file;
+        off_t offset;
+        size_t size;
+
+        // Sent after this many bytes have been taken from the send queue,
+        // to keep the order with the data queued before it
+        uint64_t after;
+    };
+
+    struct Client
+    {
+        Client(int sck, MessageHandler &handler, MessagePool &pool)
+            : sck(sck), decoder(sck, handler, pool)
+        {
+        }
+
+        const int sck;
+        MessageDecoder decoder;
+
+        // Written by sendData() under mtx_clients, read by the reactor
+        SPSCRingBuffer send_buf{SEND_BUF_SIZE};
+
+        // Total bytes put in and removed from send_buf
+        uint64_t queued   = 0;  // Under mtx_clients
+        uint64_t dequeued = 0;  // Reactor only
+
+        deque<FileSegment> segments;  // Under mtx_clients
+
+        // Segment being sent by the reactor
+        unique_ptr<FileSegment> segment;
+        size_t segment_pos = 0;
+
+        bool epollout = false;
+
+        // Set by the reactor when it has emptied send_buf: the next producer
+        // has to wake it up
+        atomic_bool idle{true};
+    };
+
+    void fn_reactor();
+
+    /**
+     * Copies data in the send queue of a client. Called under mtx_clients.
+     * @return True if the reactor has to be woken up
+     */
+    bool queue(Client &client, const uint8_t *data, size_t size);
+
+    /**
+     * Copies a message in the send queue of a client if there is enough
+     * space, otherwise counts it as dropped. Called under mtx_clients.
+     * @param wakeup Set if the reactor has to be woken up
+     * @return False if the message was dropped
+     */
+    bool queueMessage(Client &client, const uint8_t *data, size_t size,
+                      bool &wakeup);
+
+    void wakeReactor();
+
+    /**
+     * Wakes up the producers waiting for space in the send queues.
+     */
+    void notifySpace();
+
+    void acceptClients();
+    void closeClient(int sck);
+
+    /**
+     * Reads all the available data from a client.
+     * @return False if the client disconnected
+     */
+    bool receive(Client &client);
+
+    /**
+     * Sends as much queued data as possible to a client without blocking.
+     * @return False if the client disconnected
+     */
+    bool flush(Client &client);
+
+    /**
+     * Sends the data in the send queue of a client with a single call.
+     * @param limit Max number of bytes to send
+     * @return Bytes sent, -1 on error
+     */
+    ssize_t sendQueued(Client &client, size_t limit);
+
+    /**
+     * Takes the next file segment of a client, if all the data queued before
+     * it has been sent.
+     * @param limit Set to the max number of bytes that can be sent from the
+     * send queue before the next segment
+     */
+    bool takeSegment(Client &client, size_t &limit);
+
+    bool hasSegments(Client &client);
+
+    /**
+     * Sends part of the current file segment of a client with a single call.
+     * @return Bytes sent, -1 on error
+     */
+    ssize_t sendSegment(Client &client);
+
+    /**
+     * Enables or disables the EPOLLOUT event for a client.
+     */
+    void watchWritable(Client &client, bool enable);
+
     uint8_t *recv_buf;
 
     const int port;
 
-    void fn_server();
-    void fn_sender();
+    int sck_server = -1;
+    int fd_epoll   = -1;
+    int fd_wakeup  = -1;  // eventfd used to signal queued data to the reactor
 
-    bool receive();
+    // Only the reactor thread adds or removes clients. Also serializes the
+    // producers of the send queues.
+    mutex mtx_clients;
+    map<int, unique_ptr<Client>> clients;
 
-    atomic_int sck_client{-1};
-    int sck_server = -1;
+    // Signaled by the reactor when data has been removed from a send queue
+    condition_variable cv_space;
 
-    condition_variable cv_sender;
-    mutex mtx_sender;
-    atomic_bool client_connected{false};
-    CircularBuffer send_buf{SEND_BUF_SIZE};  // buffer guarded by mtx_sender
+    // Messages dropped because a queue was full, counted once for each
+    // client. Under mtx_clients.
+    DropCounter dropped[NUM_MSG_TYPES];
 
-    unique_ptr<thread> thread_recv;
-    atomic_bool thread_recv_terminated{false};
+    unique_ptr<thread> thread_reactor;
 
-    unique_ptr<thread> thread_send;
-    atomic_bool thread_send_terminated{false};
+    // One payload buffer per client: each decoder holds at most one
+    MessagePool msg_pool{MAX_CLIENTS};
 
-    MessageDecoder &decoder;
+    MessageHandler &handler;
 };
 
 #endif /* SRC_COMMUNICATION_TCPSERVER_H */
@@ -6,14 +6,20 @@
 #ifndef SRC_FUNCTIONS_CAMERAFUNCTION_H
 #define SRC_FUNCTIONS_CAMERAFUNCTION_H
 
+#include "camera/DownloadPipeline.h"
 #include "logger.h"
+#include "utils/TimingStats.h"
 
 #include <atomic>
+#include <chrono>
+#include <memory>
 #include <thread>
 #include <future>
 
 using std::atomic_bool;
 using std::thread;
+using std::unique_ptr;
+using std::chrono::steady_clock;
 
 static const char* DEFAULT_DOWNLOAD_FOLDER = "/home/pi/CCCaptures/";
 
@@ -45,6 +51,15 @@ public:
 
     virtual bool downloadAfterExposure() { return download_after_exposure; };
 
+    /**
+     * If enabled, captured files are downloaded on a separate thread while the
+     * next exposure is already in progress. Only used when downloading after
+     * exposure. Takes effect the next time the function is started.
+     */
+    virtual void pipelinedDownload(bool value) { pipelined_download = value; };
+
+    virtual bool pipelinedDownload() { return pipelined_download; };
+
     virtual bool isStarted()  = 0;
     virtual bool isFinished() = 0;
 
@@ -86,6 +101,9 @@ public:
             Log.e("Camera is not responsive!");
             return false;
         }
+
+        // Settings may have been changed on the camera while idle
+        camera.pollEvents();
         return true;
     }
 
@@ -94,6 +112,66 @@ public:
 protected:
     bool isTesting() { return testing; }
 
+    /**
+     * Takes an exposure and downloads it if requested, either immediately or
+     * through the download pipeline if it has been started.
+     */
+    bool captureExposure(int exposure_time)
+    {
+        auto start = steady_clock::now();
+        if (last_capture_end != steady_clock::time_point())
+        {
+            Timings.record(TIMING_INTERFRAME_GAP, start - last_capture_end);
+        }
+
+        bool success;
+        CameraFilePath p{};
+
+        if (!downloadAfterExposure())
+        {
+            success = camera.capture(exposure_time);
+        }
+        else if (download_pipeline == nullptr)
+        {
+            success = camera.capture(exposure_time, download_folder);
+        }
+        else if ((success = camera.capture(exposure_time, p)))
+        {
+            download_pipeline->enqueue(p, download_folder + string(p.name));
+        }
+
+        last_capture_end = steady_clock::now();
+        return success;
+    }
+
+    void startDownloadPipeline()
+    {
+        if (pipelinedDownload() && download_pipeline == nullptr)
+        {
+            Log.i("Pipelined download enabled.");
+            download_pipeline =
+                unique_ptr<DownloadPipeline>(new DownloadPipeline(camera));
+        }
+    }
+
+    /**
+     * Waits for all the pending downloads to complete.
+     */
+    void stopDownloadPipeline()
+    {
+        if (download_pipeline != nullptr)
+        {
+            Log.i("Waiting for pending downloads...");
+            download_pipeline->finish();
+            Log.i("Downloads completed: %d, failed: %d",
+                  download_pipeline->downloadedCount(),
+                  download_pipeline->failedCount());
+            download_pipeline.reset();
+        }
+        // Flush the files not synced yet by a batched sync policy
+        camera.getStorage().sync();
+    }
+
     CameraWrapper& camera;
 
     string download_folder;
@@ -103,6 +181,11 @@ protected:
 private:
 
     atomic_bool download_after_exposure{};
+    atomic_bool pipelined_download{};
+
+    unique_ptr<DownloadPipeline> download_pipeline;
+
+    steady_clock::time_point last_capture_end;
 };
 
 #endif /* SRC_FUNCTIONS_CAMERAFUNCTION_H */
@@ -5,28 +5,31 @@
 
 #include "intervalometer.h"
 #include "logger.h"
+#include "utils/TimingStats.h"
 
 using namespace std::this_thread;
 
 using std::unique_lock;
 
 using std::chrono::duration_cast;
+using std::chrono::microseconds;
 using std::chrono::milliseconds;
-using std::chrono::system_clock;
+using std::chrono::steady_clock;
 
 typedef unique_lock<mutex> Lock;
-typedef system_clock Clock;
+typedef steady_clock Clock;
 
 Intervalometer::Intervalometer(int n_exposures, int interval, int exposure_time,
                                bool download_after_exposure,
-                               string download_folder)
+                               LatePolicy late_policy, string download_folder)
     : CameraFunction(download_folder), interval(milliseconds(interval)),
-      num_shots(n_exposures), exposure_time(exposure_time)
+      num_shots(n_exposures), exposure_time(exposure_time),
+      late_policy(late_policy)
 {
     downloadAfterExposure(download_after_exposure);
 
-    Log.i("Intervalometer configured: Number of exposures: %d, Exp time: %d, Interval: %d",
-          n_exposures, exposure_time, interval);
+    Log.i("Intervalometer configured: Number of exposures: %d, Exp time: %d, Interval: %d, Late policy: %d",
+          n_exposures, exposure_time, interval, (int)late_policy);
 }
 
 Intervalometer::~Intervalometer() {}
@@ -78,52 +81,103 @@ bool Intervalometer::isFinished() { return finished; }
 
 void Intervalometer::run()
 {
-    int i = 0;
+    startDownloadPipeline();
+
+    // Exposure N is scheduled at t0 + N * interval, so that delays do not
+    // accumulate over the sequence
+    auto t0   = Clock::now();
+    long slot = 0;
+    int i     = 0;
+
     while (!abort_cond && (i < num_shots || num_shots == -1))
     {
-        auto start         = Clock::now();
-        auto next_exposure = start + interval;
-        i++;
+        auto scheduled = t0 + slot * interval;
 
-        if (!camera.capture(exposure_time,
-                            downloadAfterExposure() ? download_folder : ""))
+        // Catch up with the camera events while waiting for the next slot
+        if (scheduled - Clock::now() > EVENT_POLL_MIN_IDLE)
         {
-            Log.e("Capture %d failed.", i);
-            break;
+            camera.pollEvents();
         }
 
-        auto end = Clock::now();
+        {
+            Lock lk(mutex_run);
+            while (!abort_cond)
+            {
+                if (cv_run.wait_until(lk, scheduled) == std::cv_status::timeout)
+                {
+                    break;
+                }
+            }
+        }
+        if (abort_cond)
+        {
+            break;
+        }
 
-        milliseconds remaining =
-            duration_cast<milliseconds>(next_exposure - end);
+        auto start    = Clock::now();
+        auto lateness = duration_cast<microseconds>(start - scheduled);
+        i++;
+        slot++;
 
-        if (end > next_exposure)
         {
-            Log.w("Delayed exposure by: %d ms", -1 * (int)remaining.count());
+            Lock lk(mutex_run);
+            stats.registerExposureStat(
+                (int)duration_cast<milliseconds>(lateness).count());
         }
+        frame_lateness.record(lateness.count() > 0 ? lateness.count() : 0);
+        Timings.record(TIMING_FRAME_LATENESS, lateness);
 
+        if (!captureExposure(exposure_time))
         {
-            Lock lk(mutex_run);
-            stats.registerExposureStat(-1 * (int)remaining.count());
+            Log.e("Capture %d failed.", i);
+            break;
+        }
 
-            while (!abort_cond)
+        auto end           = Clock::now();
+        auto next_exposure = t0 + slot * interval;
+
+        if (end > next_exposure)
+        {
+            int delay = (int)duration_cast<milliseconds>(end - next_exposure)
+                            .count();
+            switch (late_policy)
             {
-                if (cv_run.wait_until(lk, next_exposure) ==
-                    std::cv_status::timeout)
+                case LatePolicy::SKIP:
                 {
+                    // Move to the first slot still in the future. A zero
+                    // interval is rejected when configuring, but don't trap
+                    long missed = interval.count() > 0
+                                      ? (end - next_exposure) / interval + 1
+                                      : 1;
+                    slot += missed;
+                    Log.w("Exposure late by %d ms, skipping %d slots", delay,
+                          (int)missed);
                     break;
                 }
+                case LatePolicy::SHIFT:
+                    // Start the next exposure now and move the whole schedule
+                    t0 += end - next_exposure;
+                    Log.w("Exposure late by %d ms, shifting schedule", delay);
+                    break;
+                case LatePolicy::CATCH_UP:
+                    Log.w("Exposure late by %d ms, catching up", delay);
+                    break;
             }
         }
 
-        auto end2 = Clock::now();
-        Log.i("Period duration: %d ms",
-              (int)duration_cast<milliseconds>(end2 - start).count());
+        Log.i("Capture duration: %d ms",
+              (int)duration_cast<milliseconds>(end - start).count());
     }
 
+    stopDownloadPipeline();
+    camera.getConfigCache().print();
+
     finished = true;
     Log.i("Intervalometer finished. Shots taken: %d/%d. Aborted: %s", i,
           num_shots, abort_cond ? "true" : "false");
+    Log.i("Frame lateness: p50: %d us, p99: %d us, max: %d us",
+          (int)frame_lateness.percentile(50),
+          (int)frame_lateness.percentile(99), (int)frame_lateness.max());
 }
 
 void Intervalometer::doTestCapture()
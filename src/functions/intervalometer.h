@@ -14,9 +14,11 @@
 #include <ratio>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "camera/CameraWrapper.h"
 #include "camerafunction.h"
+#include "utils/Histogram.h"
 
 
 
@@ -26,20 +28,37 @@ using std::mutex;
 using std::string;
 using std::thread;
 using std::unique_ptr;
+using std::vector;
 using std::chrono::duration;
 using std::chrono::milliseconds;
 
+// Camera events are only read between exposures this far apart
+static const milliseconds EVENT_POLL_MIN_IDLE{200};
+
+/**
+ * What to do when an exposure ends after the next one should have started
+ */
+enum class LatePolicy : uint8_t
+{
+    SHIFT    = 0,  // Start the next exposure now and delay the schedule
+    SKIP     = 1,  // Skip the missed slots, keeping the original schedule
+    CATCH_UP = 2   // Start the next exposures immediately until back on time
+};
+
 class Intervalometer : public CameraFunction
 {
 public:
     struct IntervalometerStats
     {
-        int mean_delay() { return total_delay / exposures_count; }
-        int total_delay;
-        int max_delay;
+        int mean_delay()
+        {
+            return exposures_count > 0 ? total_delay / exposures_count : 0;
+        }
+        int total_delay = 0;
+        int max_delay   = 0;
 
-        int delayed_exposures_count;
-        int exposures_count;
+        int delayed_exposures_count = 0;
+        int exposures_count         = 0;
 
         void registerExposureStat(int delay)
         {
@@ -62,11 +81,15 @@ public:
     /**
      * Constructor
      * @param n_shots Number of exposures to take
-     * @param interval Time between the start of each exposure in milliseconds
+     * @param interval Time between the start of each exposure in milliseconds,
+     * greater than 0
+     * @param late_policy What to do if an exposure takes longer than interval.
+     * SHIFT by default, so that no exposure is lost
      */
     Intervalometer(int n_exposures, int interval, int exposure_time,
                    bool download_after_exposure,
-                   string default_folder = DEFAULT_DOWNLOAD_FOLDER);
+                   LatePolicy late_policy = LatePolicy::SHIFT,
+                   string default_folder  = DEFAULT_DOWNLOAD_FOLDER);
 
     virtual ~Intervalometer();
 
@@ -98,9 +121,13 @@ private:
     const milliseconds interval;
     const int num_shots;
     const int exposure_time;
+    const LatePolicy late_policy;
 
     IntervalometerStats stats;
 
+    // Start time of each exposure relative to its schedule, in this run
+    Histogram frame_lateness;
+
     mutex mutex_run;
     condition_variable cv_run;
     atomic_bool abort_cond{};
@@ -82,14 +82,15 @@ bool Sequencer::isFinished() { return finished; }
 
 void Sequencer::run()
 {
+    startDownloadPipeline();
+
     int i = 0;
     while (!abort_cond && (i < num_shots || num_shots == -1))
     {
         i++;
         auto start = Clock::now();
 
-        if (!camera.capture(exposure_time,
-                            downloadAfterExposure() ? download_folder : ""))
+        if (!captureExposure(exposure_time))
         {
             Log.e("Capture %d failed.", i);
             break;
@@ -112,6 +113,9 @@ void Sequencer::run()
         }
     }
 
+    stopDownloadPipeline();
+    camera.getConfigCache().print();
+
     finished = true;
     Log.i("Sequencer finished. Shots taken: %d/%d. Aborted: %s", i, num_shots,
           abort_cond ? "true" : "false");
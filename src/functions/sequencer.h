@@ -36,7 +36,9 @@ public:
     {
         int mean_intertime()
         {
-            return total_exposure_intertime / exposures_count;
+            return exposures_count > 0
+                       ? total_exposure_intertime / exposures_count
+                       : 0;
         }
 
         int exposure_time        = 0;
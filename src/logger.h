@@ -6,15 +6,23 @@
 #ifndef SRC_LOGGER_H
 #define SRC_LOGGER_H
 
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <ctime>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <ostream>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include "utils/MPSCQueue.h"
+
 using std::cout;
 using std::endl;
 using std::lock_guard;
@@ -34,6 +42,14 @@ enum LogLevel : int
 
 static const string LEVEL_STRINGS[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
 
+static const unsigned int LOG_MSG_SIZE = 256;
+
+// Number of records that can be waiting to be written in async mode
+static const size_t LOG_QUEUE_SIZE = 1024;
+
+// Max time a record waits in the queue before being written in async mode
+static const unsigned int LOG_FLUSH_PERIOD = 10;  // ms
+
 class Logger
 {
 public:
@@ -41,7 +57,48 @@ public:
     {
         this->streams = streams;
     }
-    ~Logger() {}
+    ~Logger() { stopAsync(); }
+
+    /**
+     * Switches to async mode: log() only pushes the message in a lock-free
+     * queue, while a background thread formats the queued messages and writes
+     * them to the streams in batches. Messages are dropped if the queue is
+     * full.
+     */
+    void startAsync()
+    {
+        if (thread_flush == nullptr)
+        {
+            flush_running = true;
+            thread_flush =
+                std::unique_ptr<std::thread>(new std::thread(&Logger::run, this));
+            async = true;
+        }
+    }
+
+    /**
+     * Writes all the queued messages and goes back to synchronous logging.
+     * Must be called before the streams are destroyed.
+     */
+    void stopAsync()
+    {
+        // Synchronous messages wait for the queued ones to be written
+        lock_guard<mutex> l(mtx_log);
+        if (thread_flush != nullptr)
+        {
+            // Stop accepting records, and let the pushes already started
+            // complete before the final drain
+            async = false;
+            while (pushing > 0)
+            {
+                std::this_thread::yield();
+            }
+
+            flush_running = false;
+            thread_flush->join();
+            thread_flush.reset();
+        }
+    }
 
     template <typename T, typename... Args>
     void i(const char* str, T value, Args... args)
@@ -80,10 +137,12 @@ public:
     void removeStream(ostream* stream)
     {
         lock_guard<mutex> l(mtx_streams);
-        for (auto it = streams.begin(); it != streams.end(); it++)
+        for (auto it = streams.begin(); it != streams.end();)
         {
             if ((*it).first == stream)
                 it = streams.erase(it);
+            else
+                it++;
         }
     }
 
@@ -96,18 +155,38 @@ public:
     template <typename T, typename... Args>
     void log(LogLevel level, const char* str, T value, Args... args)
     {
-        char buf[256];
-        sprintf(buf, str, value, args...);
+        char buf[LOG_MSG_SIZE];
+        snprintf(buf, LOG_MSG_SIZE, str, value, args...);
 
         log(level, buf);
     }
 
     void log(LogLevel level, const char* str)
     {
-        auto t  = std::time(nullptr);
+        auto t = std::time(nullptr);
+
+        // Checked by stopAsync() before the final drain
+        pushing++;
+        if (async)
+        {
+            LogRecord record;
+            record.time  = t;
+            record.level = level;
+            strncpy(record.msg, str, LOG_MSG_SIZE - 1);
+            record.msg[LOG_MSG_SIZE - 1] = '\0';
+
+            if (!queue.push(record))
+            {
+                dropped++;
+            }
+            pushing--;
+            return;
+        }
+        pushing--;
+
         auto tm = *std::localtime(&t);
-        lock_guard<mutex> l1(mtx_streams);
-        lock_guard<mutex> l2(mtx_log);
+        lock_guard<mutex> l1(mtx_log);
+        lock_guard<mutex> l2(mtx_streams);
         for (auto it = streams.begin(); it != streams.end(); it++)
         {
             if (level >= (*it).second)
@@ -121,6 +200,79 @@ public:
     }
 
 private:
+    struct LogRecord
+    {
+        time_t time;
+        LogLevel level;
+        char msg[LOG_MSG_SIZE];
+    };
+
+    /**
+     * Background thread writing the queued records in async mode.
+     */
+    void run()
+    {
+        LogRecord record;
+
+        while (true)
+        {
+            bool running = flush_running;
+            int count    = 0;
+            {
+                lock_guard<mutex> l1(mtx_streams);
+                while (queue.pop(record))
+                {
+                    write(record);
+                    count++;
+                }
+
+                unsigned int n_dropped = dropped.exchange(0);
+                if (n_dropped > 0)
+                {
+                    record.time  = std::time(nullptr);
+                    record.level = LOG_WARNING;
+                    snprintf(record.msg, LOG_MSG_SIZE,
+                             "%u log messages dropped", n_dropped);
+                    write(record);
+                    count++;
+                }
+
+                if (count > 0)
+                {
+                    for (auto it = streams.begin(); it != streams.end(); it++)
+                    {
+                        (*it).first->flush();
+                    }
+                }
+            }
+
+            if (!running)
+            {
+                break;
+            }
+            std::this_thread::sleep_for(
+                std::chrono::milliseconds(LOG_FLUSH_PERIOD));
+        }
+    }
+
+    /**
+     * Writes a record on all the streams, without flushing them.
+     * mtx_streams must be held.
+     */
+    void write(const LogRecord& record)
+    {
+        auto tm = *std::localtime(&record.time);
+        for (auto it = streams.begin(); it != streams.end(); it++)
+        {
+            if (record.level >= (*it).second)
+            {
+                *(*it).first << std::put_time(&tm, "[%H:%M:%S]") << std::left
+                             << std::setw(10) << getLogLevelString(record.level)
+                             << record.msg << '\n';
+            }
+        }
+    }
+
     vector<pair<ostream*, LogLevel>> streams;
 
     string getLogLevelString(LogLevel level)
@@ -130,6 +282,13 @@ private:
 
     mutex mtx_log;
     mutex mtx_streams;
+
+    std::atomic_bool async{false};
+    std::atomic_bool flush_running{false};
+    std::atomic_uint dropped{0};
+    std::atomic_uint pushing{0};  // Calls to log() pushing in the queue
+    MPSCQueue<LogRecord, LOG_QUEUE_SIZE> queue;
+    std::unique_ptr<std::thread> thread_flush;
 };
 
 extern Logger Log;
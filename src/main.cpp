@@ -1,4 +1,5 @@
 #include "CameraWrapper.h"
+#include "SimulatedBackend.h"
 
 #include <stdlib.h>
 #include <chrono>
@@ -7,7 +8,8 @@
 #include <fstream>
 #include <thread>
 #include "circular_buffer.h"
-#include "commands/Commands.h"
+#include "commands/CommandDispatcher.h"
+#include "communication/FileSender.h"
 #include "communication/MessageDecoder.h"
 #include "communication/TCPStream.h"
 #include "functions/camerafunction.h"
@@ -15,215 +17,426 @@
 #include "functions/sequencer.h"
 #include "logger.h"
 #include "utils/RemoteTrigger.h"
+#include "utils/TimingStats.h"
+#include "utils/TriggerBenchmark.h"
 
 using namespace std::chrono;
 using namespace std::this_thread;
 
+using std::lock_guard;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
 
 Logger Log;
+TimingStats Timings;
 
 CameraWrapper* camera;
 
 TCPServer* server;
 MessageHandler* msghandler;
-MessageDecoder* decoder;
 MessageEncoder* encoder;
+FileSender* filesender;
 
 NetStream* netstream;
 std::ofstream ofs("cameracontroller_log.txt", std::ofstream::out);
 
 CameraFunction* activeFunction = nullptr;
 
-class CommandHandler : public OnMessageReceivedListener
+LatePolicy latePolicy(uint8_t value)
 {
-    void onCommandReceived(const Command& command) override
+    switch (value)
     {
-        switch (command.cmd_id)
-        {
-            case CMD_ID_REBOOT:
-                Log.i("Received reboot command");
-                sleep_for(seconds(5));
-                system("sudo reboot");
-                break;
-            case CMD_ID_SHUTDOWN:
-                Log.i("Received shutdown command");
-                sleep_for(seconds(5));
-                system("sudo halt");
-                break;
-            case CMD_ID_CAMERA_TEST_CONNECTION:
-                if (camera->isConnected())
-                {
-                    Log.i("Camera connected.");
-                }
-                else
-                {
-                    Log.w("Camera not connected.");
-                    break;
-                }
-                if (camera->isResponsive())
-                {
-                    Log.i("Camera responsive.");
-                }
-                else
-                {
-                    Log.w("Camera not responsive.");
-                    break;
-                }
-                break;
-            case CMD_ID_CAMERA_RECONNECT:
-                Log.i("Disconnecting...");
-                camera->disconnect();
-                sleep_for(seconds(5));
-                Log.i("Reconnecting...");
-                camera->connect();
-                break;
-            case CMD_ID_SEQUENCERSETUP:
-            {
-                // Cast
-                const SequencerSetupCommand& cmd =
-                    reinterpret_cast<const SequencerSetupCommand&>(command);
+        case (uint8_t)LatePolicy::SKIP:
+            return LatePolicy::SKIP;
+        case (uint8_t)LatePolicy::CATCH_UP:
+            return LatePolicy::CATCH_UP;
+        default:
+            return LatePolicy::SHIFT;
+    }
+}
 
-                if (activeFunction != nullptr)
-                {
-                    if (!activeFunction->isOperating())
-                    {
-                        // If finished, delete old sequencer
-                        delete activeFunction;
-                        // Create a new sequencer
-                        activeFunction = new Sequencer(
-                            cmd.num_exposures, cmd.exp_time, cmd.download);
-                    }
-                    else
-                    {
-                        Log.e(
-                                "Cannot configure sequencer: Function "
-                                "already running.");
-                    }
-                }
-                else
-                {
-                    // No function configured
-                    activeFunction = new Sequencer(
-                        cmd.num_exposures, cmd.exp_time, cmd.download);
-                }
+class CommandHandler : public CommandListener
+{
+    bool onReboot(const Command&) override
+    {
+        Log.i("Received reboot command");
+        sleep_for(seconds(5));
+        return system("sudo reboot") == 0;
+    }
 
-                break;
-            }
-            case CMD_ID_INTERVALOMETERSETUP:
-            {
-                Log.d("Received intervalometer config");
-                // Cast
-                const IntervalometerSetupCommand& cmd =
-                    reinterpret_cast<const IntervalometerSetupCommand&>(command);
+    bool onShutdown(const Command&) override
+    {
+        Log.i("Received shutdown command");
+        sleep_for(seconds(5));
+        return system("sudo halt") == 0;
+    }
 
-                if (activeFunction != nullptr)
-                {
-                    if (!activeFunction->isOperating())
-                    {
-                        // If finished, delete old sequencer
-                        delete activeFunction;
-                        // Create a new sequencer
-                        activeFunction = new Intervalometer(
-                            cmd.num_exposures, cmd.interval, cmd.exp_time, cmd.download);
-                    }
-                    else
-                    {
-                        Log.e(
-                                "Cannot configure intervalometer: Function "
-                                "already running.");
-                    }
-                }
-                else
-                {
-                    // No function configured
-                    activeFunction = new Intervalometer(
-                        cmd.num_exposures, cmd.interval, cmd.exp_time, cmd.download);
-                }
+    bool onCameraTestConnection(const Command&) override
+    {
+        if (camera->isConnected())
+        {
+            Log.i("Camera connected.");
+        }
+        else
+        {
+            Log.w("Camera not connected.");
+            return false;
+        }
+        if (camera->isResponsive())
+        {
+            Log.i("Camera responsive.");
+            return true;
+        }
+        else
+        {
+            Log.w("Camera not responsive.");
+            return false;
+        }
+    }
 
-                break;
+    bool onCameraReconnect(const Command&) override
+    {
+        Log.i("Disconnecting...");
+        camera->disconnect();
+        Log.i("Reconnecting...");
+        camera->connect();
+        return camera->isConnected();
+    }
+
+    bool onSequencerSetup(const SequencerSetupCommand& cmd) override
+    {
+        lock_guard<mutex> l(mtx_function);
+        if (activeFunction != nullptr)
+        {
+            if (!activeFunction->isOperating())
+            {
+                // If finished, delete old sequencer
+                delete activeFunction;
+                // Create a new sequencer
+                activeFunction = new Sequencer(cmd.num_exposures, cmd.exp_time,
+                                               cmd.download);
             }
-            case CMD_ID_DOWNLOAD_AFTER_EXPOSURE:
+            else
             {
-                const DownloadAfterExposureCommand& cmd =
-                    reinterpret_cast<const DownloadAfterExposureCommand&>(
-                        command);
-                if (activeFunction != nullptr)
-                {
-                    activeFunction->downloadAfterExposure(cmd.download);
-                    Log.i("Downloading after exposure: %s",
-                          cmd.download ? "yes" : "no");
-                }
-                else
-                {
-                    Log.w("No function configured.");
-                }
-                break;
+                Log.e(
+                    "Cannot configure sequencer: Function "
+                    "already running.");
+                return false;
             }
-            case CMD_ID_FUNCTION_TEST_CAPTURE:
+        }
+        else
+        {
+            // No function configured
+            activeFunction =
+                new Sequencer(cmd.num_exposures, cmd.exp_time, cmd.download);
+        }
+        return true;
+    }
+
+    bool onIntervalometerSetup(const IntervalometerSetupCommand& cmd) override
+    {
+        Log.d("Received intervalometer config");
+
+        if (cmd.interval <= 0)
+        {
+            Log.e("Cannot configure intervalometer: Interval must be > 0.");
+            return false;
+        }
+
+        lock_guard<mutex> l(mtx_function);
+        if (activeFunction != nullptr)
+        {
+            if (!activeFunction->isOperating())
             {
-                if (activeFunction != nullptr)
-                {
-                    activeFunction->testCapture();
-                }
-                else if (activeFunction == nullptr)
-                {
-                    Log.w("No function configured.");
-                }
-                break;
+                // If finished, delete old sequencer
+                delete activeFunction;
+                // Create a new sequencer
+                activeFunction = new Intervalometer(
+                    cmd.num_exposures, cmd.interval, cmd.exp_time,
+                    cmd.download, latePolicy(cmd.late_policy));
             }
-            case CMD_ID_FUNCTIONSTART:
+            else
             {
-                if (activeFunction != nullptr)
-                {
-                    activeFunction->start();
-                }
-                else if (activeFunction == nullptr)
-                {
-                    Log.w("No function configured.");
-                }
-                break;
+                Log.e(
+                    "Cannot configure intervalometer: Function "
+                    "already running.");
+                return false;
             }
+        }
+        else
+        {
+            // No function configured
+            activeFunction = new Intervalometer(
+                cmd.num_exposures, cmd.interval, cmd.exp_time, cmd.download,
+                latePolicy(cmd.late_policy));
+        }
+        return true;
+    }
 
-            case CMD_ID_FUNCTIONSTOP:
-            {
-                if (activeFunction != nullptr && activeFunction->isStarted())
-                {
-                    activeFunction->abort();
-                }
-                else if (activeFunction == nullptr)
+    bool onDownloadAfterExposure(
+        const DownloadAfterExposureCommand& cmd) override
+    {
+        lock_guard<mutex> l(mtx_function);
+        if (activeFunction != nullptr)
+        {
+            activeFunction->downloadAfterExposure(cmd.download);
+            Log.i("Downloading after exposure: %s",
+                  cmd.download ? "yes" : "no");
+            return true;
+        }
+        else
+        {
+            Log.w("No function configured.");
+            return false;
+        }
+    }
+
+    bool onPipelinedDownload(const PipelinedDownloadCommand& cmd) override
+    {
+        lock_guard<mutex> l(mtx_function);
+        if (activeFunction != nullptr)
+        {
+            activeFunction->pipelinedDownload(cmd.pipelined);
+            Log.i("Pipelined download: %s", cmd.pipelined ? "yes" : "no");
+            return true;
+        }
+        else
+        {
+            Log.w("No function configured.");
+            return false;
+        }
+    }
+
+    bool onFunctionTestCapture(const Command&) override
+    {
+        CameraFunction* function = getFunction();
+        if (function != nullptr)
+        {
+            function->testCapture();
+            return true;
+        }
+        else
+        {
+            Log.w("No function configured.");
+            return false;
+        }
+    }
+
+    bool onFunctionStart(const Command&) override
+    {
+        CameraFunction* function = getFunction();
+        if (function != nullptr)
+        {
+            return function->start();
+        }
+        else
+        {
+            Log.w("No function configured.");
+            return false;
+        }
+    }
+
+    bool onFunctionStop(const Command&) override
+    {
+        // Runs on the urgent thread, while a setup command may be replacing
+        // the function on the other one
+        lock_guard<mutex> l(mtx_function);
+        if (activeFunction != nullptr && activeFunction->isStarted())
+        {
+            activeFunction->abort();
+        }
+        else if (activeFunction == nullptr)
+        {
+            Log.w("No function configured.");
+            return false;
+        }
+        return true;
+    }
+
+    bool onGetTimingStats(const Command&) override
+    {
+        json j;
+        Timings.toJson(j);
+        camera->getConfigCache().statsToJson(j["config_cache"]);
+        string s = j.dump();
+        return encoder->sendTelemetry(s.c_str(), s.size());
+    }
+
+    bool onResetTimingStats(const Command&) override
+    {
+        Log.i("Timing statistics reset");
+        Timings.reset();
+        return true;
+    }
+
+    bool onGetServerStats(const Command&) override
+    {
+        json j;
+        server->statsToJson(j);
+        string s = j.dump();
+        return encoder->sendTelemetry(s.c_str(), s.size());
+    }
+
+    /**
+     * Sends the timing of the last BULB exposures: wall clock time of the
+     * opening and closing trigger, in microseconds since the epoch, and
+     * measured and requested length, in microseconds.
+     */
+    bool onGetExposures(const Command&) override
+    {
+        json list = json::array();
+        for (const ExposureTiming& e : camera->getExposures())
+        {
+            auto length    = duration_cast<microseconds>(e.close - e.open);
+            auto requested = duration_cast<microseconds>(e.requested);
+            auto open      = duration_cast<microseconds>(
+                e.open_wall.time_since_epoch());
+
+            list.push_back({{"open", open.count()},
+                            {"close", (open + length).count()},
+                            {"length", length.count()},
+                            {"requested", requested.count()}});
+        }
+
+        json j;
+        j["exposures"] = list;
+        string s       = j.dump();
+        return encoder->sendTelemetry(s.c_str(), s.size());
+    }
+
+    bool onFileDownload(const FileDownloadCommand& cmd) override
+    {
+        return filesender->request(cmd.client, cmd.name, cmd.offset,
+                                  cmd.checksum);
+    }
+
+    bool onFileAbort(const Command&) override
+    {
+        filesender->abort();
+        return true;
+    }
+
+    bool onStorageSetup(const StorageSetupCommand& cmd) override
+    {
+        StorageConfig config;
+        switch (cmd.sync_mode)
+        {
+            case (uint8_t)SyncMode::NONE:
+                config.sync_mode = SyncMode::NONE;
+                break;
+            case (uint8_t)SyncMode::PER_FILE:
+                config.sync_mode = SyncMode::PER_FILE;
+                break;
+            case (uint8_t)SyncMode::BATCHED:
+                if (cmd.sync_batch == 0)
                 {
-                    Log.w("No function configured.");
+                    Log.e("Storage setup: sync batch must be at least 1.");
+                    return false;
                 }
-            }
+                config.sync_mode  = SyncMode::BATCHED;
+                config.sync_batch = cmd.sync_batch;
+                break;
+            default:
+                Log.e("Storage setup: unknown sync mode %d.", cmd.sync_mode);
+                return false;
         }
+
+        camera->getStorage().setConfig(config);
+        Log.i("Storage sync mode: %d, batch: %u", cmd.sync_mode,
+              config.sync_batch);
+        return true;
+    }
+
+private:
+    // Functions are only replaced on the normal priority thread, so the
+    // returned one stays valid while this thread uses it
+    CameraFunction* getFunction()
+    {
+        lock_guard<mutex> l(mtx_function);
+        return activeFunction;
     }
+
+    // Protects activeFunction
+    mutex mtx_function;
 };
 
 CommandHandler* cmdhandler;
+CommandExecutor* executor;
+
+/**
+ * Reports the state of a command to the client that sent it: its sequence
+ * number as soon as it is accepted, then its result.
+ */
+void sendAck(const CommandAck& ack)
+{
+    json j;
+    if (ack.accepted)
+    {
+        j["accepted"] = {{"seq", ack.seq}, {"cmd_id", ack.cmd_id}};
+    }
+    else
+    {
+        j["ack"] = {{"seq", ack.seq},         {"cmd_id", ack.cmd_id},
+                    {"ok", ack.success},      {"rejected", ack.rejected},
+                    {"wait_us", ack.wait_us}, {"run_us", ack.run_us}};
+    }
+
+    string s = j.dump();
+    encoder->sendTelemetry(s.c_str(), s.size(), ack.client);
+}
 
 void init()
 {
     camera     = &CameraWrapper::getInstance();
     cmdhandler = new CommandHandler();
-    msghandler = new MessageHandler(*cmdhandler);
-    decoder    = new MessageDecoder(*msghandler);
-    server     = new TCPServer(*decoder);
+    executor   = new CommandExecutor(*cmdhandler, &sendAck);
+    msghandler = new MessageHandler(*executor);
+    server     = new TCPServer(*msghandler);
 
-    encoder   = new MessageEncoder(server);
-    netstream = new NetStream(encoder);
+    encoder    = new MessageEncoder(server);
+    netstream  = new NetStream(encoder);
+    filesender = new FileSender(*encoder, DEFAULT_DOWNLOAD_FOLDER);
 
     // camera->connect();
 }
 
-int main()
+/**
+ * Writes the queued log messages and detaches the log file, which is
+ * destroyed before the logger.
+ */
+void stopLogging()
+{
+    Log.stopAsync();
+    Log.removeStream(&ofs);
+    ofs.close();
+}
+
+int main(int argc, char* argv[])
 {
-    piHiPri(20);
     Log.addStream(&ofs, LOG_DEBUG);
+    // Keep logging off the capture threads
+    Log.startAsync();
+
+    // Check the IR trigger timing, without the GPIOs
+    if (argc > 1 && string(argv[1]) == "--bench-trigger")
+    {
+        unsigned int iterations = argc > 2 ? atoi(argv[2]) : 20;
+        unsigned int load       = argc > 3 ? atoi(argv[3]) : 0;
+        runTriggerBenchmark(iterations, load);
+
+        stopLogging();
+        return 0;
+    }
     initTrigger();
     init();
 
+    // Run without a camera attached, to test the functions timings
+    if (argc > 1 && string(argv[1]) == "--simulate")
+    {
+        Log.w("Using simulated camera.");
+        camera->setBackend(new SimulatedBackend());
+    }
+
     Log.addStream(netstream, LOG_INFO);
 
     server->start();
@@ -235,7 +448,7 @@ int main()
         sleep_for(seconds(60));
     }
 
-    ofs.close();
+    stopLogging();
 
     return 0;
 }
@@ -0,0 +1,147 @@
+#ifndef SRC_SPSC_RING_BUFFER_H
+#define SRC_SPSC_RING_BUFFER_H
+
+#include <sys/uio.h>
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+
+/**
+ * Byte ring buffer safe for one producer thread and one consumer thread
+ * without locking. Unlike CircularBuffer it never overwrites data that has not
+ * been read yet: put() only writes as much as fits.
+ * Size must be a power of two.
+ */
+class SPSCRingBuffer
+{
+public:
+    SPSCRingBuffer(size_t size) : size(size), mask(size - 1)
+    {
+        assert(size > 0 && (size & (size - 1)) == 0);
+        buffer = new uint8_t[size];
+    }
+
+    ~SPSCRingBuffer() { delete[] buffer; }
+
+    SPSCRingBuffer(const SPSCRingBuffer&) = delete;
+    SPSCRingBuffer& operator=(const SPSCRingBuffer&) = delete;
+
+    /**
+     * Producer only.
+     * @return Number of bytes written
+     */
+    size_t put(const uint8_t* values, size_t length)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+
+        length = std::min(length, size - (h - t));
+        if (length == 0)
+        {
+            return 0;
+        }
+
+        size_t start = h & mask;
+        size_t sz    = std::min(length, size - start);
+
+        memcpy(buffer + start, values, sz);        // From head to end
+        memcpy(buffer, values + sz, length - sz);  // From start to new head
+
+        head.store(h + length, std::memory_order_release);
+        return length;
+    }
+
+    /**
+     * Consumer only.
+     * @return Number of bytes read
+     */
+    size_t get(uint8_t* buf, size_t length)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+
+        length = std::min(length, h - t);
+        if (length == 0)
+        {
+            return 0;
+        }
+
+        size_t start = t & mask;
+        size_t sz    = std::min(length, size - start);
+
+        memcpy(buf, buffer + start, sz);
+        memcpy(buf + sz, buffer, length - sz);
+
+        tail.store(t + length, std::memory_order_release);
+        return length;
+    }
+
+    /**
+     * Consumer only. Exposes the data that can be read without copying it, as
+     * up to two contiguous regions. The data stays in the buffer until
+     * consume() is called.
+     * @param max_length Max number of bytes to expose
+     * @return Number of regions filled (0 if the buffer is empty)
+     */
+    int peek(iovec regions[2], size_t max_length) const
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+
+        size_t length = std::min(max_length, h - t);
+        if (length == 0)
+        {
+            return 0;
+        }
+
+        size_t start = t & mask;
+        size_t sz    = std::min(length, size - start);
+
+        regions[0].iov_base = buffer + start;
+        regions[0].iov_len  = sz;
+        if (sz == length)
+        {
+            return 1;
+        }
+
+        regions[1].iov_base = buffer;
+        regions[1].iov_len  = length - sz;
+        return 2;
+    }
+
+    /**
+     * Consumer only. Removes data exposed by peek().
+     */
+    void consume(size_t length)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        assert(length <= head.load(std::memory_order_acquire) - t);
+
+        tail.store(t + length, std::memory_order_release);
+    }
+
+    size_t currentSize() const
+    {
+        return head.load(std::memory_order_acquire) -
+               tail.load(std::memory_order_acquire);
+    }
+
+    size_t freeSpace() const { return size - currentSize(); }
+
+    size_t totalSize() const { return size; }
+
+private:
+    const size_t size;
+    const size_t mask;
+    uint8_t* buffer;
+
+    // Free running counters: only the lowest bits are used as index
+    std::atomic<size_t> head{0};  // Written by the producer
+    std::atomic<size_t> tail{0};  // Written by the consumer
+};
+
+#endif /* SRC_SPSC_RING_BUFFER_H */
@@ -0,0 +1,104 @@
+#ifndef SRC_UTILS_BOUNDEDQUEUE_H
+#define SRC_UTILS_BOUNDEDQUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+/**
+ * Blocking FIFO queue with a fixed capacity.
+ * put() blocks while the queue is full, take() blocks while it is empty.
+ * offer() fails instead of blocking.
+ * After close() is called no more elements are accepted, and take() returns
+ * false once the remaining elements have been consumed.
+ */
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    bool put(const T& item)
+    {
+        std::unique_lock<std::mutex> l(mtx);
+        while (queue.size() >= capacity && !closed)
+        {
+            cv_not_full.wait(l);
+        }
+        if (closed)
+        {
+            return false;
+        }
+        queue.push_back(item);
+        l.unlock();
+
+        cv_not_empty.notify_one();
+        return true;
+    }
+
+    /**
+     * Never blocks.
+     * @return False if the queue is full or closed
+     */
+    bool offer(const T& item)
+    {
+        {
+            std::lock_guard<std::mutex> l(mtx);
+            if (queue.size() >= capacity || closed)
+            {
+                return false;
+            }
+            queue.push_back(item);
+        }
+
+        cv_not_empty.notify_one();
+        return true;
+    }
+
+    bool take(T& item)
+    {
+        std::unique_lock<std::mutex> l(mtx);
+        while (queue.empty() && !closed)
+        {
+            cv_not_empty.wait(l);
+        }
+        if (queue.empty())
+        {
+            return false;
+        }
+        item = queue.front();
+        queue.pop_front();
+        l.unlock();
+
+        cv_not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> l(mtx);
+            closed = true;
+        }
+        cv_not_empty.notify_all();
+        cv_not_full.notify_all();
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> l(mtx);
+        return queue.size();
+    }
+
+private:
+    const size_t capacity;
+    std::deque<T> queue;
+    bool closed = false;
+
+    std::mutex mtx;
+    std::condition_variable cv_not_empty;
+    std::condition_variable cv_not_full;
+};
+
+#endif /* SRC_UTILS_BOUNDEDQUEUE_H */
@@ -0,0 +1,55 @@
+#ifndef SRC_UTILS_CRC32_H
+#define SRC_UTILS_CRC32_H
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Table driven CRC-32 (IEEE 802.3, same as zlib's crc32()).
+ * Checksums can be computed incrementally by passing the result of the
+ * previous call as the initial value.
+ */
+class Crc32
+{
+public:
+    static uint32_t update(uint32_t crc, const uint8_t* data, size_t len)
+    {
+        const uint32_t* t = table();
+
+        crc = ~crc;
+        for (size_t i = 0; i < len; i++)
+        {
+            crc = t[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+private:
+    Crc32() {}
+
+    static const uint32_t* table()
+    {
+        static Table t;
+        return t.values;
+    }
+
+    struct Table
+    {
+        uint32_t values[256];
+
+        Table()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+                }
+                values[i] = c;
+            }
+        }
+    };
+};
+
+#endif /* SRC_UTILS_CRC32_H */
@@ -0,0 +1,27 @@
+#ifndef SRC_UTILS_FILEHANDLE_H
+#define SRC_UTILS_FILEHANDLE_H
+
+#include <unistd.h>
+
+/**
+ * Owns a file descriptor and closes it when destroyed. Shared between the
+ * users of an open file through a shared_ptr.
+ */
+struct FileHandle
+{
+    const int fd;
+
+    explicit FileHandle(int fd) : fd(fd) {}
+    ~FileHandle()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+};
+
+#endif /* SRC_UTILS_FILEHANDLE_H */
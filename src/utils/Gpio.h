@@ -0,0 +1,41 @@
+#ifndef SRC_UTILS_GPIO_H
+#define SRC_UTILS_GPIO_H
+
+#include <wiringPi.h>
+
+/**
+ * Digital outputs used by the triggers.
+ */
+class GpioBackend
+{
+public:
+    virtual ~GpioBackend() {}
+
+    virtual void setup() = 0;
+
+    virtual void setOutput(int pin) = 0;
+
+    /**
+     * Sets the level of an output pin. Called from timing critical code: must
+     * not block.
+     */
+    virtual void write(int pin, bool level) = 0;
+};
+
+/**
+ * GPIOs of the Raspberry Pi, through wiringPi.
+ */
+class WiringPiGpio : public GpioBackend
+{
+public:
+    void setup() override { wiringPiSetup(); }
+
+    void setOutput(int pin) override { pinMode(pin, OUTPUT); }
+
+    void write(int pin, bool level) override
+    {
+        digitalWrite(pin, level ? HIGH : LOW);
+    }
+};
+
+#endif /* SRC_UTILS_GPIO_H */
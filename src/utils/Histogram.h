@@ -0,0 +1,140 @@
+#ifndef SRC_UTILS_HISTOGRAM_H
+#define SRC_UTILS_HISTOGRAM_H
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Log-linear histogram of durations in microseconds, in the style of
+ * HdrHistogram: each power of two is split in SUB_BUCKETS linear buckets, so
+ * the relative error of any percentile is below 1 / SUB_BUCKETS (~6%) over the
+ * whole range, with a fixed amount of memory.
+ * Values can be recorded from any thread without locking.
+ */
+class Histogram
+{
+public:
+    static const unsigned int SUB_BUCKET_BITS = 4;
+    static const unsigned int SUB_BUCKETS     = 1 << SUB_BUCKET_BITS;
+    static const unsigned int MAGNITUDES      = 33;  // Up to ~2^36 us (19 h)
+    static const unsigned int NUM_BUCKETS     = SUB_BUCKETS * MAGNITUDES;
+
+    Histogram() { reset(); }
+
+    void record(uint64_t value_us)
+    {
+        counts[bucketIndex(value_us)].fetch_add(1, std::memory_order_relaxed);
+        total_count.fetch_add(1, std::memory_order_relaxed);
+        total_sum.fetch_add(value_us, std::memory_order_relaxed);
+
+        uint64_t cur = min_value.load(std::memory_order_relaxed);
+        while (value_us < cur &&
+               !min_value.compare_exchange_weak(cur, value_us))
+        {
+        }
+        cur = max_value.load(std::memory_order_relaxed);
+        while (value_us > cur &&
+               !max_value.compare_exchange_weak(cur, value_us))
+        {
+        }
+    }
+
+    void reset()
+    {
+        for (unsigned int i = 0; i < NUM_BUCKETS; i++)
+        {
+            counts[i] = 0;
+        }
+        total_count = 0;
+        total_sum   = 0;
+        min_value   = UINT64_MAX;
+        max_value   = 0;
+    }
+
+    uint64_t count() const { return total_count; }
+
+    uint64_t min() const { return total_count > 0 ? min_value.load() : 0; }
+    uint64_t max() const { return max_value; }
+
+    uint64_t mean() const
+    {
+        uint64_t n = total_count;
+        return n > 0 ? total_sum / n : 0;
+    }
+
+    /**
+     * @param p Percentile, between 0 and 100
+     * @return Upper bound of the bucket containing the percentile, clamped to
+     * the max recorded value. 0 if empty.
+     */
+    uint64_t percentile(double p) const
+    {
+        uint64_t n = total_count;
+        if (n == 0)
+        {
+            return 0;
+        }
+
+        uint64_t target = (uint64_t)(p / 100.0 * n + 0.5);
+        if (target < 1)
+        {
+            target = 1;
+        }
+
+        uint64_t seen = 0;
+        for (unsigned int i = 0; i < NUM_BUCKETS; i++)
+        {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= target)
+            {
+                uint64_t upper = bucketUpperBound(i);
+                return upper < max() ? upper : max();
+            }
+        }
+        return max();
+    }
+
+private:
+    static unsigned int bucketIndex(uint64_t value)
+    {
+        // Values below SUB_BUCKETS are stored exactly in the first magnitude
+        if (value < SUB_BUCKETS)
+        {
+            return (unsigned int)value;
+        }
+
+        unsigned int msb = 63 - __builtin_clzll(value);
+        unsigned int magnitude = msb - SUB_BUCKET_BITS + 1;
+        if (magnitude >= MAGNITUDES)
+        {
+            return NUM_BUCKETS - 1;
+        }
+
+        unsigned int sub =
+            (unsigned int)(value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        return magnitude * SUB_BUCKETS + sub;
+    }
+
+    static uint64_t bucketUpperBound(unsigned int index)
+    {
+        unsigned int magnitude = index / SUB_BUCKETS;
+        unsigned int sub       = index % SUB_BUCKETS;
+
+        if (magnitude == 0)
+        {
+            return sub;
+        }
+
+        unsigned int shift = magnitude - 1;
+        return ((uint64_t)(SUB_BUCKETS + sub + 1) << shift) - 1;
+    }
+
+    std::atomic<uint32_t> counts[NUM_BUCKETS];
+
+    std::atomic<uint64_t> total_count;
+    std::atomic<uint64_t> total_sum;
+    std::atomic<uint64_t> min_value;
+    std::atomic<uint64_t> max_value;
+};
+
+#endif /* SRC_UTILS_HISTOGRAM_H */
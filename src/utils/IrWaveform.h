@@ -0,0 +1,106 @@
+#ifndef SRC_UTILS_IRWAVEFORM_H
+#define SRC_UTILS_IRWAVEFORM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using std::vector;
+
+// 38.4 KHz IR carrier
+static const uint32_t IR_CARRIER_HALF_PERIOD_NS = 13000;
+
+/**
+ * Output level change, at a fixed time from the start of the waveform.
+ */
+struct WaveformEdge
+{
+    uint32_t time_ns;
+    uint8_t level;
+};
+
+/**
+ * Pulse train precomputed as a table of edges, to be played back by a
+ * WaveformPlayer.
+ * Edge times are absolute from the start of the waveform, so a late edge
+ * does not delay the following ones.
+ */
+class IrWaveform
+{
+public:
+    /**
+     * Appends a burst of carrier cycles, starting from the end of the
+     * waveform.
+     */
+    void burst(unsigned int cycles)
+    {
+        for (unsigned int i = 0; i < cycles; i++)
+        {
+            edges.push_back({duration, 1});
+            edges.push_back({duration + IR_CARRIER_HALF_PERIOD_NS, 0});
+            duration += 2 * IR_CARRIER_HALF_PERIOD_NS;
+        }
+    }
+
+    /**
+     * Appends a period with the output low.
+     */
+    void gap(uint32_t us) { duration += us * 1000; }
+
+    /**
+     * Marks the last edge added so far as the one the receiver reacts to.
+     */
+    void markEffective()
+    {
+        effective_edge = edges.empty() ? 0 : edges.size() - 1;
+    }
+
+    const vector<WaveformEdge>& getEdges() const { return edges; }
+
+    size_t getEffectiveEdge() const { return effective_edge; }
+
+    /**
+     * @return Time from the first edge to the effective one
+     */
+    uint32_t getEffectiveOffsetNs() const
+    {
+        return edges.empty() ? 0 : edges[effective_edge].time_ns;
+    }
+
+    /**
+     * @return Time from the first edge to the end of the waveform
+     */
+    uint32_t getDurationNs() const { return duration; }
+
+    /**
+     * Shutter release command of the Nikon ML-L3 remote, sent twice. The
+     * camera reacts at the end of the first command.
+     */
+    static IrWaveform nikonTrigger()
+    {
+        IrWaveform w;
+        for (int j = 0; j < 2; j++)
+        {
+            w.burst(76);
+            w.gap(27810);
+            w.burst(16);
+            w.gap(1540);
+            w.burst(16);
+            w.gap(3545);
+            w.burst(16);
+            if (j == 0)
+            {
+                w.markEffective();
+                w.gap(63200);
+            }
+        }
+        return w;
+    }
+
+private:
+    vector<WaveformEdge> edges;
+    uint32_t duration     = 0;
+    size_t effective_edge = 0;
+};
+
+#endif /* SRC_UTILS_IRWAVEFORM_H */
@@ -0,0 +1,101 @@
+#ifndef SRC_UTILS_MPSCQUEUE_H
+#define SRC_UTILS_MPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Bounded lock-free queue with multiple producers and a single consumer.
+ * Each slot carries a sequence number telling whether it is free or holds an
+ * element, so producers only contend on a single atomic counter.
+ * Size must be a power of two.
+ */
+template <typename T, size_t Size>
+class MPSCQueue
+{
+    static_assert(Size >= 2 && (Size & (Size - 1)) == 0,
+                  "Size must be a power of two");
+
+public:
+    MPSCQueue()
+    {
+        for (size_t i = 0; i < Size; i++)
+        {
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Never blocks.
+     * @return False if the queue is full
+     */
+    bool push(const T& item)
+    {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Slot* slot;
+
+        while (true)
+        {
+            slot       = &slots[pos & (Size - 1)];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if (diff == 0)
+            {
+                // Slot is free: try to claim it
+                if (tail.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;  // Full
+            }
+            else
+            {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        slot->item = item;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Must only be called by the consumer thread.
+     * @return False if the queue is empty
+     */
+    bool pop(T& item)
+    {
+        Slot& slot = slots[head & (Size - 1)];
+        size_t seq = slot.seq.load(std::memory_order_acquire);
+
+        if (seq != head + 1)
+        {
+            return false;  // Empty, or the producer has not finished writing
+        }
+
+        item = slot.item;
+        slot.seq.store(head + Size, std::memory_order_release);
+        head++;
+        return true;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        T item;
+    };
+
+    Slot slots[Size];
+
+    std::atomic<size_t> tail{0};  // Next position to be claimed by producers
+    size_t head = 0;              // Next position to be read by the consumer
+};
+
+#endif /* SRC_UTILS_MPSCQUEUE_H */
@@ -0,0 +1,102 @@
+#include "RealtimeThread.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include "logger.h"
+
+RealtimeThread::RealtimeThread(int priority, int cpu)
+    : priority(priority), cpu(cpu)
+{
+    thread_rt = unique_ptr<thread>(new thread(&RealtimeThread::loop, this));
+}
+
+RealtimeThread::~RealtimeThread()
+{
+    jobs.close();
+    thread_rt->join();
+}
+
+void RealtimeThread::run(function<void()> job) { post(job).wait(); }
+
+future<void> RealtimeThread::post(function<void()> job)
+{
+    auto task = std::make_shared<packaged_task<void()>>(job);
+    auto done = task->get_future();
+
+    // A dropped task breaks its promise, which also makes the future ready
+    jobs.put(task);
+    return done;
+}
+
+/**
+ * Touches the stack below the caller, so it is mapped before it is needed.
+ */
+static void prefaultStack()
+{
+    volatile uint8_t stack[RT_STACK_PREFAULT_SIZE];
+    for (size_t i = 0; i < RT_STACK_PREFAULT_SIZE; i += 4096)
+    {
+        stack[i] = 0;
+    }
+    (void)stack[0];
+}
+
+void RealtimeThread::setup()
+{
+    // Applies to the whole process. Pages are only locked once used, so the
+    // stacks of the other threads are not loaded in memory entirely. Later
+    // allocations are left alone: the working set of the jobs is already
+    // mapped, and the stack is prefaulted below.
+    int flags = MCL_CURRENT;
+#ifdef MCL_ONFAULT
+    flags |= MCL_ONFAULT;
+#endif
+    if (mlockall(flags) != 0)
+    {
+        Log.w("Cannot lock memory: %s", std::strerror(errno));
+    }
+    prefaultStack();
+
+    int num_cpus   = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int target_cpu = cpu >= 0 ? cpu : num_cpus - 1;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(target_cpu, &cpus);
+    int result = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (result != 0)
+    {
+        Log.w("Cannot set realtime thread affinity: %s",
+              std::strerror(result));
+    }
+
+    sched_param param{};
+    param.sched_priority = priority;
+    result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (result != 0)
+    {
+        Log.w("Cannot set realtime scheduling: %s", std::strerror(result));
+        return;
+    }
+    Log.i("Realtime thread running on CPU %d, priority %d", target_cpu,
+          priority);
+}
+
+void RealtimeThread::loop()
+{
+    setup();
+
+    Job job;
+    while (jobs.take(job))
+    {
+        (*job)();
+        job.reset();
+    }
+}
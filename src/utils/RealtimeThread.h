@@ -0,0 +1,73 @@
+#ifndef SRC_UTILS_REALTIMETHREAD_H
+#define SRC_UTILS_REALTIMETHREAD_H
+
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+
+#include "BoundedQueue.h"
+
+using std::function;
+using std::future;
+using std::packaged_task;
+using std::shared_ptr;
+using std::thread;
+using std::unique_ptr;
+
+// SCHED_FIFO priority of the realtime threads
+static const int RT_THREAD_PRIORITY = 20;
+
+// Stack touched at startup, so that the thread never page faults on it
+static const size_t RT_STACK_PREFAULT_SIZE = 64 * 1024;
+
+/**
+ * Thread running timing critical jobs with SCHED_FIFO scheduling, pinned to a
+ * single CPU, with its stack prefaulted.
+ * The rest of the process keeps the normal scheduling, but memory locking
+ * is process wide: starting the thread locks the pages already mapped by the
+ * whole process as they are touched. Memory mapped later is not locked.
+ * If the process is not allowed to change its scheduling or to lock its
+ * memory, jobs still run, with a warning.
+ */
+class RealtimeThread
+{
+public:
+    /**
+     * @param cpu CPU to run on, -1 for the last one
+     */
+    RealtimeThread(int priority = RT_THREAD_PRIORITY, int cpu = -1);
+    ~RealtimeThread();
+
+    /**
+     * Executes a job on the realtime thread, waiting for it to complete.
+     * Jobs run one at a time, in order.
+     */
+    void run(function<void()> job);
+
+    /**
+     * Queues a job without waiting for it, as above.
+     * @return Ready once the job completed, or was dropped on shutdown
+     */
+    future<void> post(function<void()> job);
+
+private:
+    typedef shared_ptr<packaged_task<void()>> Job;
+
+    void loop();
+
+    /**
+     * Sets the scheduling, affinity and memory locking of the calling thread.
+     */
+    void setup();
+
+    const int priority;
+    const int cpu;
+
+    BoundedQueue<Job> jobs{4};
+
+    unique_ptr<thread> thread_rt;
+};
+
+#endif /* SRC_UTILS_REALTIMETHREAD_H */
@@ -0,0 +1,63 @@
+#ifndef SRC_UTILS_RECORDINGGPIO_H
+#define SRC_UTILS_RECORDINGGPIO_H
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "Gpio.h"
+
+using std::vector;
+using std::chrono::steady_clock;
+
+struct RecordedEdge
+{
+    steady_clock::time_point time;
+    int pin;
+    bool level;
+};
+
+/**
+ * Fake GPIOs that timestamp every write, to check the trigger timing without
+ * a Raspberry Pi.
+ * The buffer is allocated upfront: writes past its capacity are counted but
+ * not recorded, so recording never allocates.
+ */
+class RecordingGpio : public GpioBackend
+{
+public:
+    RecordingGpio(size_t capacity) { edges.reserve(capacity); }
+
+    void setup() override {}
+
+    void setOutput(int) override {}
+
+    void write(int pin, bool level) override
+    {
+        auto now = steady_clock::now();
+        if (edges.size() < edges.capacity())
+        {
+            edges.push_back({now, pin, level});
+        }
+        else
+        {
+            overflows++;
+        }
+    }
+
+    const vector<RecordedEdge>& getEdges() const { return edges; }
+
+    unsigned int getOverflows() const { return overflows; }
+
+    void clear()
+    {
+        edges.clear();
+        overflows = 0;
+    }
+
+private:
+    vector<RecordedEdge> edges;
+    unsigned int overflows = 0;
+};
+
+#endif /* SRC_UTILS_RECORDINGGPIO_H */
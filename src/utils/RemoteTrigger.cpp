@@ -5,85 +5,104 @@
 
 #include "RemoteTrigger.h"
 
+#include <atomic>
 #include <chrono>
 #include <thread>
 
+#include "IrWaveform.h"
+#include "TimingStats.h"
+#include "WaveformPlayer.h"
+#include "logger.h"
+
 using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
 using namespace std::this_thread;
 
+// Computed once, the timing is then only up to the player
+static const IrWaveform TRIGGER_WAVEFORM = IrWaveform::nikonTrigger();
+static WaveformPlayer player(PIN_TRIGGER);
+
+static WiringPiGpio wiringpi_gpio;
+// May be replaced while the realtime thread triggers
+static std::atomic<GpioBackend*> gpio{&wiringpi_gpio};
+
+void setTriggerGpio(GpioBackend* new_gpio)
+{
+    gpio.store(new_gpio != nullptr ? new_gpio : &wiringpi_gpio);
+}
+
+const IrWaveform& getTriggerWaveform() { return TRIGGER_WAVEFORM; }
+
 void initRemote()
 {
-    wiringPiSetup();
-    pinMode(PIN_TRIGGER, OUTPUT);
-    digitalWrite(PIN_TRIGGER, HIGH);
+    GpioBackend* g = gpio.load();
+    g->setup();
+    g->setOutput(PIN_TRIGGER);
+    g->write(PIN_TRIGGER, true);
 }
 
 void remoteTrigger()
 {
-    digitalWrite(PIN_TRIGGER, LOW);
+    GpioBackend* g = gpio.load();
+    g->write(PIN_TRIGGER, false);
     sleep_for(milliseconds(100));
-    digitalWrite(PIN_TRIGGER, HIGH);
+    g->write(PIN_TRIGGER, true);
 }
 
 void initTrigger()
 {
-    wiringPiSetup();
-    pinMode(PIN_TRIGGER, OUTPUT);
-    digitalWrite(PIN_TRIGGER, LOW);
+    GpioBackend* g = gpio.load();
+    g->setup();
+    g->setOutput(PIN_TRIGGER);
+    g->write(PIN_TRIGGER, false);
+}
+
+void reportTrigger(const PlaybackReport& report)
+{
+    Timings.record(TIMING_TRIGGER_EDGE_ERROR, nanoseconds(report.max_error_ns));
+    if (report.late_edges > 0)
+    {
+        Log.w("IR trigger: %u/%u late edges, max error: %d ns",
+              report.late_edges, report.edges, (int)report.max_error_ns);
+    }
+    else
+    {
+        Log.d("IR trigger: max edge error: %d ns, mean: %d ns",
+              (int)report.max_error_ns, (int)report.mean_error_ns);
+    }
 }
 
 void trigger(unsigned int repetitions)
 {
     for (unsigned int r = 0; r < repetitions; r++)
     {
-        for (int j = 0; j < 2; j++)
-        {
-            int i;
-            for (i = 0; i < 76; i++)
-            {
-                digitalWrite(PIN_TRIGGER, HIGH);
-                delayMicroseconds(7);
-                digitalWrite(PIN_TRIGGER, LOW);
-                delayMicroseconds(7);
-            }
-            delay(27);
-            delayMicroseconds(810);
-
-            for (i = 0; i < 16; i++)
-            {
-                digitalWrite(PIN_TRIGGER, HIGH);
-                delayMicroseconds(7);
-                digitalWrite(PIN_TRIGGER, LOW);
-                delayMicroseconds(7);
-            }
-            delayMicroseconds(1540);
-
-            for (i = 0; i < 16; i++)
-            {
-                digitalWrite(PIN_TRIGGER, HIGH);
-                delayMicroseconds(7);
-                digitalWrite(PIN_TRIGGER, LOW);
-                delayMicroseconds(7);
-            }
-
-            delayMicroseconds(3545);
-
-            for (i = 0; i < 16; i++)
-            {
-                digitalWrite(PIN_TRIGGER, HIGH);
-                delayMicroseconds(7);
-                digitalWrite(PIN_TRIGGER, LOW);
-                delayMicroseconds(7);
-            }
-            if (j == 0)
-            {
-                delay(63);
-                delayMicroseconds(200);
-            }
-        }
-        if(r < repetitions - 1)
+        reportTrigger(
+            player.play(*gpio.load(), TRIGGER_WAVEFORM, steady_clock::now()));
+
+        if (r < repetitions - 1)
         {
             sleep_for(milliseconds(80));
         }
     }
-}
\ No newline at end of file
+}
+
+steady_clock::time_point triggerAt(steady_clock::time_point effective_time)
+{
+    PlaybackReport report;
+    triggerAt(effective_time, report);
+    reportTrigger(report);
+    return report.effective_time;
+}
+
+steady_clock::time_point triggerAt(steady_clock::time_point effective_time,
+                                   PlaybackReport& report)
+{
+    report = player.play(*gpio.load(), TRIGGER_WAVEFORM,
+                         effective_time - getTriggerLatency());
+    return report.effective_time;
+}
+
+nanoseconds getTriggerLatency()
+{
+    return nanoseconds(TRIGGER_WAVEFORM.getEffectiveOffsetNs());
+}
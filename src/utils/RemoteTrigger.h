@@ -6,14 +6,58 @@
 #ifndef SRC_UTILS_REMOTETRIGGER_H
 #define SRC_UTILS_REMOTETRIGGER_H
 
-#include <wiringPi.h>
+#include <chrono>
+
+#include "Gpio.h"
+#include "IrWaveform.h"
+#include "WaveformPlayer.h"
+
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
 
 static const int PIN_TRIGGER = 25;
 
+/**
+ * Replaces the GPIOs used by the triggers (wiringPi by default).
+ * Thread safe: a trigger in progress keeps using the previous GPIOs.
+ * @param gpio Not owned, must outlive every trigger. nullptr to restore the
+ * default
+ */
+void setTriggerGpio(GpioBackend* gpio);
+
 // Using an IR led
 void initTrigger();
 void trigger(unsigned int repetitions = 1);
 
+/**
+ * Sends the trigger so that the camera receives it at the given time.
+ * Blocks until the trigger has been sent.
+ * @return Measured time at which the camera received the trigger
+ */
+steady_clock::time_point triggerAt(steady_clock::time_point effective_time);
+
+/**
+ * As above, without logging or recording the timing error, for realtime
+ * threads: pass the report to reportTrigger() afterwards.
+ */
+steady_clock::time_point triggerAt(steady_clock::time_point effective_time,
+                                   PlaybackReport& report);
+
+/**
+ * Logs and records the timing error of a trigger.
+ */
+void reportTrigger(const PlaybackReport& report);
+
+/**
+ * Time from the start of a trigger to when the camera receives it.
+ */
+nanoseconds getTriggerLatency();
+
+/**
+ * Pulse train sent by trigger()
+ */
+const IrWaveform& getTriggerWaveform();
+
 // Using a pre build remote
 void initRemote();
 void remoteTrigger();
@@ -0,0 +1,93 @@
+#ifndef SRC_UTILS_TIMINGSTATS_H
+#define SRC_UTILS_TIMINGSTATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+#include "Histogram.h"
+
+using json = nlohmann::json;
+
+/**
+ * Stages of a capture whose duration is recorded
+ */
+enum TimingStage : uint8_t
+{
+    TIMING_TRIGGER_LATENCY = 0,  // Time spent sending an IR trigger
+    TIMING_CAPTURE_WAIT,         // From end of BULB exposure to file on camera
+    TIMING_DOWNLOAD,             // Whole download of a file
+    TIMING_DISK_WRITE,           // Flushing a downloaded file to disk
+    TIMING_INTERFRAME_GAP,       // From end of a capture to start of the next
+    TIMING_CONNECT,              // From camera init to ready for captures
+    TIMING_TRIGGER_EDGE_ERROR,   // Max delay of an IR edge in a trigger
+    TIMING_EXPOSURE_ERROR,       // Difference from the requested BULB time
+    TIMING_FRAME_LATENESS,       // Start of an exposure after its schedule
+    TIMING_WIRED_CAPTURE,        // Whole USB capture, exposure included
+    TIMING_NUM_STAGES
+};
+
+static const char* TIMING_STAGE_NAMES[] = {
+    "trigger_latency", "capture_wait",   "download",
+    "disk_write",      "interframe_gap", "connect",
+    "trigger_edge_error", "exposure_error", "frame_lateness",
+    "wired_capture"};
+
+/**
+ * Microsecond resolution histograms of the duration of each capture stage.
+ */
+class TimingStats
+{
+public:
+    void record(TimingStage stage, uint64_t duration_us)
+    {
+        histograms[stage].record(duration_us);
+    }
+
+    template <typename Rep, typename Period>
+    void record(TimingStage stage,
+                std::chrono::duration<Rep, Period> duration)
+    {
+        auto us =
+            std::chrono::duration_cast<std::chrono::microseconds>(duration);
+        record(stage, us.count() > 0 ? (uint64_t)us.count() : 0);
+    }
+
+    const Histogram& get(TimingStage stage) const { return histograms[stage]; }
+
+    void reset()
+    {
+        for (unsigned int i = 0; i < TIMING_NUM_STAGES; i++)
+        {
+            histograms[i].reset();
+        }
+    }
+
+    /**
+     * Writes count, min, mean, percentiles and max of every stage, in
+     * microseconds.
+     */
+    void toJson(json& j) const
+    {
+        for (unsigned int i = 0; i < TIMING_NUM_STAGES; i++)
+        {
+            const Histogram& h = histograms[i];
+            json& s            = j[TIMING_STAGE_NAMES[i]];
+
+            s["count"] = h.count();
+            s["min"]   = h.min();
+            s["mean"]  = h.mean();
+            s["p50"]   = h.percentile(50);
+            s["p90"]   = h.percentile(90);
+            s["p99"]   = h.percentile(99);
+            s["max"]   = h.max();
+        }
+    }
+
+private:
+    Histogram histograms[TIMING_NUM_STAGES];
+};
+
+extern TimingStats Timings;
+
+#endif /* SRC_UTILS_TIMINGSTATS_H */
@@ -0,0 +1,150 @@
+#include "TriggerBenchmark.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "Histogram.h"
+#include "RealtimeThread.h"
+#include "RecordingGpio.h"
+#include "RemoteTrigger.h"
+#include "logger.h"
+
+using std::atomic_bool;
+using std::thread;
+using std::vector;
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+
+// The histograms are used with nanoseconds here
+struct TriggerErrors
+{
+    Histogram edge_error;
+    Histogram burst_error;
+    Histogram carrier_period;
+    unsigned int bad_triggers = 0;
+};
+
+static uint64_t absDiff(int64_t a, int64_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+/**
+ * Compares the edges recorded during a trigger with the intended ones.
+ * Times are measured from the first edge.
+ */
+static void analyze(const vector<RecordedEdge>& recorded,
+                    const vector<WaveformEdge>& expected, TriggerErrors& errors)
+{
+    if (recorded.size() < expected.size())
+    {
+        errors.bad_triggers++;
+        return;
+    }
+
+    auto t0 = recorded[0].time;
+    for (size_t i = 0; i < expected.size(); i++)
+    {
+        if (recorded[i].level != (expected[i].level != 0))
+        {
+            errors.bad_triggers++;
+            return;
+        }
+
+        int64_t actual =
+            duration_cast<nanoseconds>(recorded[i].time - t0).count();
+        uint64_t error = absDiff(actual, expected[i].time_ns);
+        errors.edge_error.record(error);
+
+        if (!expected[i].level)
+        {
+            continue;
+        }
+
+        bool burst_start =
+            i == 0 || expected[i].time_ns - expected[i - 1].time_ns >
+                          IR_CARRIER_HALF_PERIOD_NS;
+        if (burst_start)
+        {
+            errors.burst_error.record(error);
+        }
+
+        // Next rising edge in the same burst
+        if (i + 2 < expected.size() &&
+            expected[i + 2].time_ns - expected[i].time_ns ==
+                2 * IR_CARRIER_HALF_PERIOD_NS)
+        {
+            errors.carrier_period.record(
+                duration_cast<nanoseconds>(recorded[i + 2].time -
+                                           recorded[i].time)
+                    .count());
+        }
+    }
+}
+
+static void logHistogram(const char* name, const Histogram& h)
+{
+    Log.i("%s (ns): p50: %d, p99: %d, max: %d", name,
+          (int)h.percentile(50), (int)h.percentile(99), (int)h.max());
+}
+
+void runTriggerBenchmark(unsigned int iterations, unsigned int load_threads)
+{
+    const vector<WaveformEdge>& expected = getTriggerWaveform().getEdges();
+
+    // The player sets the output low once more at the end
+    RecordingGpio gpio(expected.size() + 1);
+    setTriggerGpio(&gpio);
+
+    atomic_bool stop{false};
+    vector<thread> load;
+    for (unsigned int i = 0; i < load_threads; i++)
+    {
+        load.emplace_back([&stop]() {
+            volatile uint64_t n = 0;
+            while (!stop)
+            {
+                n++;
+            }
+        });
+    }
+
+    Log.i("Trigger benchmark: %u triggers, %u load threads", iterations,
+          load_threads);
+
+    // Trigger as during a capture
+    RealtimeThread trigger_thread;
+
+    TriggerErrors errors;
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+        gpio.clear();
+        trigger_thread.run([]() { trigger(); });
+        analyze(gpio.getEdges(), expected, errors);
+    }
+
+    stop = true;
+    for (thread& t : load)
+    {
+        t.join();
+    }
+    setTriggerGpio(nullptr);
+
+    double carrier_hz =
+        errors.carrier_period.count() > 0
+            ? 1e9 / errors.carrier_period.mean()
+            : 0;
+    Log.i("Carrier: %.1f Hz (intended: %.1f Hz)", carrier_hz,
+          1e9 / (2 * IR_CARRIER_HALF_PERIOD_NS));
+    logHistogram("Carrier period", errors.carrier_period);
+    logHistogram("Burst start error", errors.burst_error);
+    logHistogram("Edge error", errors.edge_error);
+
+    if (errors.bad_triggers > 0)
+    {
+        Log.e("%u triggers did not match the waveform", errors.bad_triggers);
+    }
+}
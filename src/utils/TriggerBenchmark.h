@@ -0,0 +1,14 @@
+#ifndef SRC_UTILS_TRIGGERBENCHMARK_H
+#define SRC_UTILS_TRIGGERBENCHMARK_H
+
+/**
+ * Replays trigger() on recording GPIOs and logs the carrier frequency, the
+ * burst timing error and the edge timing error against the intended
+ * waveform. Runs on any machine.
+ * @param iterations Number of triggers
+ * @param load_threads Threads spinning on the CPU while triggering, to
+ * simulate load
+ */
+void runTriggerBenchmark(unsigned int iterations, unsigned int load_threads);
+
+#endif /* SRC_UTILS_TRIGGERBENCHMARK_H */
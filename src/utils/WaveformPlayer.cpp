@@ -0,0 +1,62 @@
+#include "WaveformPlayer.h"
+
+#include <chrono>
+#include <thread>
+
+using std::chrono::duration_cast;
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+PlaybackReport WaveformPlayer::play(GpioBackend& gpio,
+                                    const IrWaveform& waveform,
+                                    steady_clock::time_point start)
+{
+    PlaybackReport report;
+    int64_t total_error = 0;
+
+    const vector<WaveformEdge>& edges = waveform.getEdges();
+    for (size_t i = 0; i < edges.size(); i++)
+    {
+        const WaveformEdge& edge = edges[i];
+        auto target              = start + nanoseconds(edge.time_ns);
+
+        // Don't burn the CPU during the long gaps between bursts
+        auto remaining = target - steady_clock::now();
+        if (remaining > nanoseconds(PLAYER_SPIN_THRESHOLD_NS))
+        {
+            std::this_thread::sleep_for(
+                remaining - nanoseconds(PLAYER_SPIN_THRESHOLD_NS));
+        }
+        while (steady_clock::now() < target)
+        {
+        }
+
+        gpio.write(pin, edge.level != 0);
+
+        auto written  = steady_clock::now();
+        int64_t error = duration_cast<nanoseconds>(written - target).count();
+        if (i == waveform.getEffectiveEdge())
+        {
+            report.effective_time = written;
+        }
+        total_error += error;
+        if (error > report.max_error_ns)
+        {
+            report.max_error_ns = error;
+        }
+        if (error > EDGE_TOLERANCE_NS)
+        {
+            report.late_edges++;
+        }
+        report.edges++;
+    }
+
+    // Never leave the led on
+    gpio.write(pin, false);
+
+    if (report.edges > 0)
+    {
+        report.mean_error_ns = total_error / report.edges;
+    }
+    return report;
+}
@@ -0,0 +1,52 @@
+#ifndef SRC_UTILS_WAVEFORMPLAYER_H
+#define SRC_UTILS_WAVEFORMPLAYER_H
+
+#include <chrono>
+#include <cstdint>
+
+#include "Gpio.h"
+#include "IrWaveform.h"
+
+using std::chrono::steady_clock;
+
+// Edges later than this are counted as late
+static const int64_t EDGE_TOLERANCE_NS = 3000;
+
+// Sleep until this much time before an edge, then busy-wait
+static const int64_t PLAYER_SPIN_THRESHOLD_NS = 2000000;
+
+/**
+ * Timing error of the edges of a waveform, measured after setting the output.
+ */
+struct PlaybackReport
+{
+    uint32_t edges        = 0;
+    uint32_t late_edges   = 0;
+    int64_t max_error_ns  = 0;
+    int64_t mean_error_ns = 0;
+
+    // When the effective edge of the waveform was actually output
+    steady_clock::time_point effective_time;
+};
+
+/**
+ * Plays back a precomputed waveform on an output pin, busy-waiting on the
+ * monotonic clock for each edge.
+ */
+class WaveformPlayer
+{
+public:
+    WaveformPlayer(int pin) : pin(pin) {}
+
+    /**
+     * @param start Time of the first edge. Waits until then, spinning for the
+     * last part of the wait.
+     */
+    PlaybackReport play(GpioBackend& gpio, const IrWaveform& waveform,
+                        steady_clock::time_point start);
+
+private:
+    const int pin;
+};
+
+#endif /* SRC_UTILS_WAVEFORMPLAYER_H */